@@ -0,0 +1,116 @@
+#include <hayai/hayai.hpp>
+
+#include "openface/facealigner.hpp"
+#include "openface/settings.hpp"
+#include "detection/facedetector.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+class FaceAlignerTest : public ::hayai::Fixture {
+public:
+    virtual void SetUp() {
+        img = Image("test/resources/image.jpg");
+        d = fd.detect(img);
+        fa68.load(FACE_SHAPE);
+        fa5.load(FACE_SHAPE_5);
+        data.resize(3 * FACE_SIZE_CONSTRAINT * FACE_SIZE_CONSTRAINT);
+    }
+
+    FaceDetector fd;
+    FaceAligner fa68;
+    FaceAligner fa5;
+    Image img;
+    Detection d;
+    std::vector<float> data;
+};
+
+BENCHMARK_P_F(FaceAlignerTest, LoadModel, 1, 3, (const char* path)) {
+    FaceAligner fa(path);
+}
+
+BENCHMARK_P_INSTANCE(FaceAlignerTest, LoadModel, (FACE_SHAPE));
+BENCHMARK_P_INSTANCE(FaceAlignerTest, LoadModel, (FACE_SHAPE_5));
+
+BENCHMARK_F(FaceAlignerTest, Transformation68, 10, 100) {
+    fa68.transformation(d);
+}
+
+BENCHMARK_F(FaceAlignerTest, Transformation5, 10, 100) {
+    fa5.transformation(d);
+}
+
+BENCHMARK_F(FaceAlignerTest, Align68, 10, 100) {
+    fa68.align(d, data.data());
+}
+
+BENCHMARK_F(FaceAlignerTest, Align5, 10, 100) {
+    fa5.align(d, data.data());
+}
+
+/**
+ * Prints the size of both models and how far the 5 point alignment is off
+ * the 68 point alignment: the distance of the template points in the aligned
+ * face and the mean absolute difference of the aligned pixels.
+ */
+void print_accuracy(const std::vector<std::string>& paths) {
+    const char* models[] = {FACE_SHAPE, FACE_SHAPE_5};
+    for (size_t i = 0; i < 2; i++) {
+        std::ifstream file(models[i], std::ios::binary | std::ios::ate);
+        std::cout << models[i] << ": " << file.tellg() / (1024*1024.) << " MiB" << std::endl;
+    }
+
+    FaceDetector fd;
+    FaceAligner fa68(FACE_SHAPE);
+    FaceAligner fa5(FACE_SHAPE_5);
+    const int n = 3 * FACE_SIZE_CONSTRAINT * FACE_SIZE_CONSTRAINT;
+    std::vector<float> a68(n), a5(n);
+
+    size_t faces = 0;
+    double distance = 0, worst = 0, pixels = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        Image img(paths[i]);
+        std::vector<Detection> ds = fd.detect_all(img);
+        for (size_t j = 0; j < ds.size(); j++, faces++) {
+            // Template points mapped back with the 68 point and forward with the 5 point alignment
+            cv::Mat H68 = fa68.transformation(ds[j]);
+            cv::Mat H5 = fa5.transformation(ds[j]);
+            cv::Mat inv;
+            cv::invertAffineTransform(H68, inv);
+            std::vector<cv::Point2f> points(OUTER_EYES_AND_NOSE, OUTER_EYES_AND_NOSE + 3);
+            cv::transform(points, points, inv);
+            cv::transform(points, points, H5);
+            for (size_t k = 0; k < 3; k++) {
+                double dist = cv::norm(points[k] - OUTER_EYES_AND_NOSE[k]);
+                distance += dist / 3;
+                worst = std::max(worst, dist);
+            }
+
+            fa68.align(ds[j], a68.data());
+            fa5.align(ds[j], a5.data());
+            for (int k = 0; k < n; k++)
+                pixels += std::abs(a68[k] - a5[k]) / n;
+        }
+    }
+
+    if (faces == 0)
+        return;
+    std::cout << faces << " faces, template points off by " << distance / faces
+              << " px on average and " << worst << " px at most, mean pixel difference "
+              << 255 * pixels / faces << " of 255" << std::endl;
+}
+
+int main()
+{
+    std::vector<std::string> paths;
+    paths.push_back("test/resources/image.jpg");
+    print_accuracy(paths);
+
+    hayai::ConsoleOutputter consoleOutputter;
+
+    hayai::Benchmarker::AddOutputter(consoleOutputter);
+    hayai::Benchmarker::RunAllTests();
+    return 0;
+}
@@ -3,14 +3,33 @@
 
 #include "detection/facedetector.hpp"
 
+// Camera sized frames, made by upscaling the test image
+static const cv::Size HD(1280, 720);
+static const cv::Size FULL_HD(1920, 1080);
+static const cv::Size UHD(3840, 2160);
+static const double SCALES[] = {1., 0.5, 0.25};
+
 class FaceDetectorTest : public ::hayai::Fixture {
 public:
     virtual void SetUp() {
 	img = cv::imread("test/resources/image.jpg");
+	noface = cv::imread("test/resources/image_noface.jpg");
+	fd.load("resources/haarcascade_frontalface_alt.xml", "");
 	gpuimg.upload(img);
+	cv::resize(img, frame, FULL_HD);
+	cv::resize(img, hd, HD);
+	cv::resize(img, uhd, UHD);
+    }
+
+    cv::Mat& frame_of(int height) {
+	return height == HD.height ? hd : height == UHD.height ? uhd : frame;
     }
 
     cv::Mat img;
+    cv::Mat noface;
+    cv::Mat frame;
+    cv::Mat hd;
+    cv::Mat uhd;
     cv::cuda::GpuMat gpuimg;
     FaceDetector fd;
 };
@@ -25,8 +44,114 @@ BENCHMARK_F(FaceDetectorTest, GPUDetect, 1, 10) {
 }
 #endif
 
+BENCHMARK_P_F(FaceDetectorTest, DetectMode, 1, 10, (DetectionMode mode)) {
+    fd.set_mode(mode);
+    fd.detect_all(img);
+    fd.detect_all(noface);
+}
+
+BENCHMARK_P_INSTANCE(FaceDetectorTest, DetectMode, (HOG));
+BENCHMARK_P_INSTANCE(FaceDetectorTest, DetectMode, (HAAR));
+BENCHMARK_P_INSTANCE(FaceDetectorTest, DetectMode, (CASCADE));
+
+BENCHMARK_P_F(FaceDetectorTest, DlibDetectFullHD, 1, 10, (double scale)) {
+    fd.set_scale(scale);
+    fd.dlib_detect_all(frame);
+}
+
+BENCHMARK_P_INSTANCE(FaceDetectorTest, DlibDetectFullHD, (1.));
+BENCHMARK_P_INSTANCE(FaceDetectorTest, DlibDetectFullHD, (0.5));
+BENCHMARK_P_INSTANCE(FaceDetectorTest, DlibDetectFullHD, (0.25));
+
+// Latency of a single frame, serial pyramid against levels on all cores
+BENCHMARK_P_F(FaceDetectorTest, HogLatency, 1, 5, (int height, DetectionMode mode)) {
+    fd.set_mode(mode);
+    fd.detect_all(frame_of(height));
+}
+
+BENCHMARK_P_INSTANCE(FaceDetectorTest, HogLatency, (720, HOG));
+BENCHMARK_P_INSTANCE(FaceDetectorTest, HogLatency, (720, HOG_PARALLEL));
+BENCHMARK_P_INSTANCE(FaceDetectorTest, HogLatency, (1080, HOG));
+BENCHMARK_P_INSTANCE(FaceDetectorTest, HogLatency, (1080, HOG_PARALLEL));
+BENCHMARK_P_INSTANCE(FaceDetectorTest, HogLatency, (2160, HOG));
+BENCHMARK_P_INSTANCE(FaceDetectorTest, HogLatency, (2160, HOG_PARALLEL));
+
+/**
+ * Prints the fraction of the faces found at full resolution that are still
+ * found at each scale, where a face counts as found if the rectangles have
+ * an intersection over union of at least 0.5.
+ */
+void print_recall(const std::vector<std::string>& paths) {
+    FaceDetector fd;
+    std::vector<std::vector<Detection> > reference;
+    std::vector<Image> frames;
+    for (size_t i = 0; i < paths.size(); i++) {
+        cv::Mat frame;
+        cv::resize(cv::imread(paths[i]), frame, FULL_HD);
+        frames.push_back(Image(frame));
+        reference.push_back(fd.dlib_detect_all(frames.back()));
+    }
+
+    for (size_t s = 0; s < sizeof(SCALES)/sizeof(SCALES[0]); s++) {
+        fd.set_scale(SCALES[s]);
+        size_t found = 0, total = 0;
+        for (size_t i = 0; i < frames.size(); i++) {
+            std::vector<Detection> ds = fd.dlib_detect_all(frames[i]);
+            for (size_t j = 0; j < reference[i].size(); j++, total++) {
+                for (size_t k = 0; k < ds.size(); k++) {
+                    if (reference[i][j].rect.iou(ds[k].rect) >= 0.5) {
+                        found++;
+                        break;
+                    }
+                }
+            }
+        }
+        std::cout << "Recall at scale " << SCALES[s] << ": " << found << "/" << total << std::endl;
+    }
+}
+
+/**
+ * Prints how many faces each mode finds on the test images, where the HOG
+ * detections serve as ground truth for precision and recall.
+ */
+void print_modes(const std::vector<std::string>& paths) {
+    FaceDetector fd("resources/haarcascade_frontalface_alt.xml", "");
+    const DetectionMode modes[] = {HAAR, CASCADE};
+    const char* names[] = {"Haar", "Cascade"};
+
+    for (size_t m = 0; m < 2; m++) {
+        size_t found = 0, correct = 0, total = 0;
+        for (size_t i = 0; i < paths.size(); i++) {
+            Image img(paths[i]);
+            fd.set_mode(HOG);
+            std::vector<Detection> reference = fd.detect_all(img);
+            fd.set_mode(modes[m]);
+            std::vector<Detection> ds = fd.detect_all(img);
+
+            total += reference.size();
+            found += ds.size();
+            for (size_t k = 0; k < ds.size(); k++) {
+                for (size_t j = 0; j < reference.size(); j++) {
+                    if (reference[j].rect.iou(ds[k].rect) >= 0.5) {
+                        correct++;
+                        break;
+                    }
+                }
+            }
+        }
+        std::cout << names[m] << ": " << correct << "/" << found << " detections match HOG, "
+                  << correct << "/" << total << " HOG faces found" << std::endl;
+    }
+}
+
 int main()
 {
+    std::vector<std::string> paths;
+    paths.push_back("test/resources/image.jpg");
+    paths.push_back("test/resources/image_noface.jpg");
+    print_recall(std::vector<std::string>(1, paths[0]));
+    print_modes(paths);
+
     hayai::ConsoleOutputter consoleOutputter;
 
     hayai::Benchmarker::AddOutputter(consoleOutputter);
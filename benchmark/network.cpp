@@ -0,0 +1,54 @@
+#include <hayai/hayai.hpp>
+
+#include "openface/neuralnetwork.hpp"
+
+#include <memory>
+#include <vector>
+
+/**
+ * Returns the native network, calibrated on the test face and switched to
+ * int8 if #quantized. Networks are loaded once and shared by all benchmarks.
+ */
+static NeuralNetwork& network(bool quantized) {
+    static std::unique_ptr<NeuralNetwork> nns[2];
+    std::unique_ptr<NeuralNetwork>& nn = nns[quantized];
+    if (!nn) {
+        nn.reset(new NeuralNetwork(NATIVE_NEURAL_NETWORK));
+        nn->set_num_threads(1);
+        if (quantized) {
+            nn->calibrate(std::vector<Image>(1, Image("test/resources/face.png")));
+            nn->set_quantized(true);
+        }
+    }
+    return *nn;
+}
+
+class NetworkTest : public ::hayai::Fixture {
+public:
+    virtual void SetUp() {
+        faces.assign(8, Image("test/resources/face.png"));
+    }
+
+    std::vector<Image> faces;
+};
+
+BENCHMARK_F(NetworkTest, Float, 1, 10) {
+    network(false).forward_nn(faces);
+}
+
+BENCHMARK_F(NetworkTest, Int8, 1, 10) {
+    network(true).forward_nn(faces);
+}
+
+int main()
+{
+    std::cout << "Every run forwards 8 faces on a single thread." << std::endl;
+    for (int q = 0; q < 2; q++)
+        std::cout << (q ? "int8" : "float") << " weights: " << network(q).weight_bytes() / 1024 << " KiB" << std::endl;
+
+    hayai::ConsoleOutputter consoleOutputter;
+
+    hayai::Benchmarker::AddOutputter(consoleOutputter);
+    hayai::Benchmarker::RunAllTests();
+    return 0;
+}
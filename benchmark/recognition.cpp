@@ -0,0 +1,107 @@
+#include <hayai/hayai.hpp>
+
+#include "learning/linearscorer.hpp"
+#include "learning/distance.hpp"
+#include "../test/embeddings.hpp"
+
+#include <dlib/rand.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Returns a one vs all decision function with random support vectors.
+ *
+ * Training a thousand classes takes hours, but the prediction only depends
+ * on the number of classes and support vectors, not on their values.
+ */
+static ova_decision_function random_decision_function(size_t classes, size_t support_vectors) {
+    dlib::rand rnd(classes);
+    ova_decision_function::binary_function_table dfs;
+    for (size_t c = 0; c < classes; c++) {
+        std::vector<FaceNetEmbed> svs = random_embeddings(support_vectors, c);
+        dlib::decision_function<linear_kernel> f;
+        f.alpha.set_size(support_vectors);
+        f.basis_vectors.set_size(support_vectors);
+        for (size_t i = 0; i < support_vectors; i++) {
+            f.alpha(i) = rnd.get_random_gaussian();
+            f.basis_vectors(i) = svs[i];
+        }
+        f.b = rnd.get_random_gaussian();
+        dfs["person" + std::to_string(c)] = linear_probabilistic_function(-1 - rnd.get_random_double(), 0, f);
+    }
+    return ova_decision_function(dfs);
+}
+
+/**
+ * Decision functions are built once per number of classes and shared by all benchmarks.
+ */
+static ova_decision_function& decision_function(size_t classes) {
+    static std::map<size_t, std::shared_ptr<ova_decision_function> > dfs;
+    std::shared_ptr<ova_decision_function>& df = dfs[classes];
+    if (!df)
+        df = std::make_shared<ova_decision_function>(random_decision_function(classes, 50));
+    return *df;
+}
+
+/**
+ * The same decision functions compiled into LinearScorers.
+ */
+static LinearScorer& compiled(size_t classes) {
+    static std::map<size_t, std::shared_ptr<LinearScorer> > scorers;
+    std::shared_ptr<LinearScorer>& scorer = scorers[classes];
+    if (!scorer)
+        scorer = std::make_shared<LinearScorer>(decision_function(classes));
+    return *scorer;
+}
+
+class RecognitionTest : public ::hayai::Fixture {
+public:
+    virtual void SetUp() {
+        queries = random_embeddings(100, 1);
+    }
+
+    std::vector<FaceNetEmbed> queries;
+};
+
+BENCHMARK_P_F(RecognitionTest, DecisionFunction, 1, 10, (size_t classes)) {
+    ova_decision_function& df = decision_function(classes);
+    for (size_t i = 0; i < queries.size(); i++)
+        df.predict(queries[i]);
+}
+
+BENCHMARK_P_INSTANCE(RecognitionTest, DecisionFunction, (10));
+BENCHMARK_P_INSTANCE(RecognitionTest, DecisionFunction, (100));
+BENCHMARK_P_INSTANCE(RecognitionTest, DecisionFunction, (1000));
+
+BENCHMARK_P_F(RecognitionTest, Compiled, 1, 10, (size_t classes)) {
+    LinearScorer& scorer = compiled(classes);
+    for (size_t i = 0; i < queries.size(); i++)
+        scorer.classify(queries[i]);
+}
+
+BENCHMARK_P_INSTANCE(RecognitionTest, Compiled, (10));
+BENCHMARK_P_INSTANCE(RecognitionTest, Compiled, (100));
+BENCHMARK_P_INSTANCE(RecognitionTest, Compiled, (1000));
+
+BENCHMARK_P_F(RecognitionTest, CompiledBatch, 1, 10, (size_t classes)) {
+    LinearScorer& scorer = compiled(classes);
+    scorer.classify(queries);
+}
+
+BENCHMARK_P_INSTANCE(RecognitionTest, CompiledBatch, (10));
+BENCHMARK_P_INSTANCE(RecognitionTest, CompiledBatch, (100));
+BENCHMARK_P_INSTANCE(RecognitionTest, CompiledBatch, (1000));
+
+int main()
+{
+    std::cout << "Dot product kernel: " << squared_distances_isa() << std::endl;
+    std::cout << "Every run scores 100 faces with 50 support vectors per class." << std::endl;
+
+    hayai::ConsoleOutputter consoleOutputter;
+
+    hayai::Benchmarker::AddOutputter(consoleOutputter);
+    hayai::Benchmarker::RunAllTests();
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include <hayai/hayai.hpp>
+
+#include "learning/embeddingindex.hpp"
+#include "learning/distance.hpp"
+#include "learning/productquantizer.hpp"
+#include "../test/embeddings.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+
+/**
+ * Returns a gallery of #n embeddings, ten per identity on average.
+ */
+static std::vector<FaceNetEmbed> gallery_embeddings(size_t n) {
+    return identity_embeddings(n, std::max<size_t>(1, n / 10), n, n + 1);
+}
+
+/**
+ * Returns #count queries of people in the gallery of #n embeddings, which
+ * are not part of the gallery themselves.
+ */
+static std::vector<FaceNetEmbed> query_embeddings(size_t n, size_t count) {
+    return identity_embeddings(count, std::max<size_t>(1, n / 10), n, n + 2);
+}
+
+/**
+ * 100 queries per gallery size, shared by all benchmarks.
+ */
+static const std::vector<FaceNetEmbed>& queries(size_t n) {
+    static std::map<size_t, std::vector<FaceNetEmbed> > sets;
+    std::vector<FaceNetEmbed>& qs = sets[n];
+    if (qs.empty())
+        qs = query_embeddings(n, 100);
+    return qs;
+}
+
+/**
+ * Galleries are built once per size and shared by all benchmarks.
+ */
+static BruteForceIndex& gallery(size_t n) {
+    static std::map<size_t, std::shared_ptr<BruteForceIndex> > galleries;
+    std::shared_ptr<BruteForceIndex>& index = galleries[n];
+    if (!index) {
+        index = std::make_shared<BruteForceIndex>();
+        index->reserve(n);
+        index->add(gallery_embeddings(n));
+    }
+    return *index;
+}
+
+/**
+ * Graphs over the same galleries, built on all cores.
+ */
+static HNSWIndex& graph(size_t n) {
+    static std::map<size_t, std::shared_ptr<HNSWIndex> > graphs;
+    std::shared_ptr<HNSWIndex>& index = graphs[n];
+    if (!index) {
+        index = std::make_shared<HNSWIndex>();
+        index->add(gallery_embeddings(n));
+    }
+    return *index;
+}
+
+static std::map<size_t, std::shared_ptr<PQIndex> > quantized_indices;
+
+/**
+ * Vector file of the product quantized gallery of #n embeddings.
+ */
+static std::string vectors_path(size_t n) {
+    return "pq_vectors_" + std::to_string(n) + ".dat";
+}
+
+/**
+ * Product quantized copies of the galleries, 16 bytes per embedding, with the
+ * full embeddings in a vector file for the reranking.
+ */
+static PQIndex& quantized(size_t n) {
+    std::shared_ptr<PQIndex>& index = quantized_indices[n];
+    if (!index) {
+        std::vector<FaceNetEmbed> es = gallery_embeddings(n);
+        ProductQuantizer pq(16);
+        pq.train(std::vector<FaceNetEmbed>(es.begin(), es.begin() + std::min<size_t>(n, 20000)));
+        index = std::make_shared<PQIndex>(pq, vectors_path(n));
+        index->add(es);
+    }
+    return *index;
+}
+
+/**
+ * Closes the product quantized indices and deletes their vector files.
+ */
+static void remove_quantized() {
+    for (std::map<size_t, std::shared_ptr<PQIndex> >::iterator i = quantized_indices.begin(); i != quantized_indices.end(); ++i) {
+        i->second.reset();
+        std::remove(vectors_path(i->first).c_str());
+    }
+    quantized_indices.clear();
+}
+
+class SearchTest : public ::hayai::Fixture {
+};
+
+BENCHMARK_P_F(SearchTest, BruteForceTop10, 1, 10, (size_t n, int threads)) {
+    BruteForceIndex& index = gallery(n);
+    const std::vector<FaceNetEmbed>& qs = queries(n);
+    index.set_threads(threads);
+    for (size_t i = 0; i < qs.size(); i++)
+        index.search(qs[i], 10);
+}
+
+BENCHMARK_P_INSTANCE(SearchTest, BruteForceTop10, (10000, 1));
+BENCHMARK_P_INSTANCE(SearchTest, BruteForceTop10, (10000, std::thread::hardware_concurrency()));
+BENCHMARK_P_INSTANCE(SearchTest, BruteForceTop10, (100000, 1));
+BENCHMARK_P_INSTANCE(SearchTest, BruteForceTop10, (100000, std::thread::hardware_concurrency()));
+BENCHMARK_P_INSTANCE(SearchTest, BruteForceTop10, (1000000, 1));
+BENCHMARK_P_INSTANCE(SearchTest, BruteForceTop10, (1000000, std::thread::hardware_concurrency()));
+
+BENCHMARK_P_F(SearchTest, HNSWTop10, 1, 10, (size_t n, size_t ef)) {
+    HNSWIndex& index = graph(n);
+    const std::vector<FaceNetEmbed>& qs = queries(n);
+    index.set_ef(ef);
+    for (size_t i = 0; i < qs.size(); i++)
+        index.search(qs[i], 10);
+}
+
+BENCHMARK_P_INSTANCE(SearchTest, HNSWTop10, (100000, 16));
+BENCHMARK_P_INSTANCE(SearchTest, HNSWTop10, (100000, 64));
+BENCHMARK_P_INSTANCE(SearchTest, HNSWTop10, (100000, 256));
+BENCHMARK_P_INSTANCE(SearchTest, HNSWTop10, (1000000, 16));
+BENCHMARK_P_INSTANCE(SearchTest, HNSWTop10, (1000000, 64));
+BENCHMARK_P_INSTANCE(SearchTest, HNSWTop10, (1000000, 256));
+
+BENCHMARK_P_F(SearchTest, PQTop10, 1, 10, (size_t n, size_t rerank)) {
+    PQIndex& index = quantized(n);
+    const std::vector<FaceNetEmbed>& qs = queries(n);
+    index.set_rerank(rerank);
+    for (size_t i = 0; i < qs.size(); i++)
+        index.search(qs[i], 10);
+}
+
+BENCHMARK_P_INSTANCE(SearchTest, PQTop10, (100000, 1));
+BENCHMARK_P_INSTANCE(SearchTest, PQTop10, (100000, 16));
+BENCHMARK_P_INSTANCE(SearchTest, PQTop10, (1000000, 1));
+BENCHMARK_P_INSTANCE(SearchTest, PQTop10, (1000000, 16));
+
+/**
+ * Prints the build time of the graph and, for several ef, the fraction of the
+ * exact 10 nearest neighbours it finds and the queries per second on one
+ * thread.
+ */
+void print_recall(size_t n) {
+    std::vector<FaceNetEmbed> queries = query_embeddings(n, 1000);
+    BruteForceIndex& exact = gallery(n);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    HNSWIndex& index = graph(n);
+    std::chrono::duration<double> build = std::chrono::steady_clock::now() - start;
+    std::cout << "HNSW over " << n << " embeddings built in " << build.count() << " s" << std::endl;
+
+    std::vector<std::vector<Neighbor> > expected(queries.size());
+    for (size_t q = 0; q < queries.size(); q++)
+        expected[q] = exact.search(queries[q], 10);
+
+    const size_t efs[] = {10, 16, 32, 64, 128, 256};
+    for (size_t e = 0; e < sizeof(efs)/sizeof(efs[0]); e++) {
+        index.set_ef(efs[e]);
+        size_t found = 0;
+        std::chrono::duration<double> time(0);
+        for (size_t q = 0; q < queries.size(); q++) {
+            start = std::chrono::steady_clock::now();
+            std::vector<Neighbor> nbs = index.search(queries[q], 10);
+            time += std::chrono::steady_clock::now() - start;
+            for (size_t i = 0; i < nbs.size(); i++) {
+                for (size_t j = 0; j < expected[q].size(); j++)
+                    found += nbs[i].id == expected[q][j].id;
+            }
+        }
+        std::cout << "  ef " << efs[e] << ": recall@10 " << found / (10. * queries.size())
+                  << ", " << queries.size() / time.count() << " queries/s" << std::endl;
+    }
+}
+
+/**
+ * Prints the memory of the codes against the floats and, for several rerank
+ * factors, how often the nearest neighbour matches the exact search and the
+ * queries per second.
+ */
+void print_compression(size_t n) {
+    std::vector<FaceNetEmbed> queries = query_embeddings(n, 1000);
+    BruteForceIndex& exact = gallery(n);
+    PQIndex& index = quantized(n);
+    std::cout << "PQ over " << n << " embeddings: " << index.code_bytes() << " bytes instead of "
+              << n * EMBEDDING_DIMS * sizeof(float) << std::endl;
+
+    std::vector<size_t> expected(queries.size());
+    for (size_t q = 0; q < queries.size(); q++)
+        expected[q] = exact.search(queries[q], 1)[0].id;
+
+    const size_t reranks[] = {1, 4, 16, 64};
+    for (size_t r = 0; r < sizeof(reranks)/sizeof(reranks[0]); r++) {
+        index.set_rerank(reranks[r]);
+        size_t found = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t q = 0; q < queries.size(); q++)
+            found += index.search(queries[q], 10)[0].id == expected[q];
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+        std::cout << "  rerank " << reranks[r] << ": top-1 " << found / double(queries.size())
+                  << ", " << queries.size() / time.count() << " queries/s" << std::endl;
+    }
+}
+
+int main()
+{
+    std::cout << "Distance kernel: " << squared_distances_isa() << std::endl;
+    std::cout << "Every run searches 100 queries." << std::endl;
+    print_recall(100000);
+    print_recall(1000000);
+    print_compression(100000);
+    print_compression(1000000);
+
+    hayai::ConsoleOutputter consoleOutputter;
+
+    hayai::Benchmarker::AddOutputter(consoleOutputter);
+    hayai::Benchmarker::RunAllTests();
+    remove_quantized();
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include <hayai/hayai.hpp>
+
+#include "openface/pixelconversion.hpp"
+#include "openface/torchinterface.hpp"
+
+#include <vector>
+
+class PixelConversionTest : public ::hayai::Fixture {
+public:
+    virtual void SetUp() {
+        face = Image("test/resources/face.png");
+        bgr.assign(3*n, 128);
+        planes.resize(3*n);
+    }
+
+    const size_t n = 96*96;
+    Image face;
+    std::vector<unsigned char> bgr;
+    std::vector<float> planes;
+};
+
+BENCHMARK_F(PixelConversionTest, Scalar, 10, 1000) {
+    bgr_to_planar_rgb_scalar(bgr.data(), n, planes.data(), planes.data() + n, planes.data() + 2*n);
+}
+
+BENCHMARK_F(PixelConversionTest, Dispatched, 10, 1000) {
+    bgr_to_planar_rgb(bgr.data(), n, planes.data(), planes.data() + n, planes.data() + 2*n);
+}
+
+BENCHMARK_F(PixelConversionTest, TensorFromImage, 10, 1000) {
+    Tensor t(face);
+}
+
+int main()
+{
+    std::cout << "Dispatched kernel: " << bgr_to_planar_rgb_isa() << std::endl;
+
+    hayai::ConsoleOutputter consoleOutputter;
+
+    hayai::Benchmarker::AddOutputter(consoleOutputter);
+    hayai::Benchmarker::RunAllTests();
+    return 0;
+}
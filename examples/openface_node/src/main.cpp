@@ -1,6 +1,7 @@
 #include "openface/openface.hpp"
 #include "learning/facerecognizer.hpp"
 #include "detection/facedetector.hpp"
+#include "detection/videosession.hpp"
 #include "database/facedatabase.hpp"
 
 #include <ros/ros.h>
@@ -14,6 +15,7 @@ class OpenFaceRecognizer {
     FaceRecognizer fr_;
     OpenFace of_;
     FaceDetector fd_;
+    VideoSession session_;
 
     ros::NodeHandle nh_;
     ros::Publisher name_pub;
@@ -29,7 +31,7 @@ public:
 };
 
 
-OpenFaceRecognizer::OpenFaceRecognizer() : it_(nh_) {
+OpenFaceRecognizer::OpenFaceRecognizer() : session_(fd_), it_(nh_) {
     image_sub = it_.subscribe("/usb_cam/image_raw", 1, &OpenFaceRecognizer::imageCb, this, image_transport::TransportHints::TransportHints("theora"));
     name_pub = nh_.advertise<std_msgs::String>("/facerecognizer/name", 1);
     fr_.load("facedatabase.dat");
@@ -47,11 +49,11 @@ void OpenFaceRecognizer::imageCb(const sensor_msgs::ImageConstPtr& msg) {
     cv::Mat msg_img = cv_ptr->image;
     Image img(msg_img);
     std::cout << img.width() << std::endl;
-    Detection detect = fd_.detect(img);
-    if (detect.face.width() == 0)
+    std::vector<Track> tracks = session_.process(img);
+    if (tracks.empty())
         return;
 
-    FaceNetEmbed rep = of_.facenet(detect.face);
+    FaceNetEmbed rep = of_.facenet(tracks[0].detection);
 
     std::string label = fr_.recognize(rep);
 
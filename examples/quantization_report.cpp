@@ -0,0 +1,89 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include "openface/neuralnetwork.hpp"
+#include "database/facedatabase.hpp"
+#include "learning/facerecognizer.hpp"
+
+using namespace std;
+
+/**
+ * Compares the int8 mode of the native network with the float network on a
+ * database of aligned faces and writes the calibration for later use with
+ * NeuralNetwork::quantize().
+ *
+ * Usage: quantization_report <aligned faces> [calibration file] [calibration faces]
+ */
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <aligned faces> [calibration file] [calibration faces]" << endl;
+        return -1;
+    }
+    string calibration = argc > 2 ? argv[2] : "resources/nn4.v2.calibration";
+    size_t calibration_faces = argc > 3 ? atoi(argv[3]) : 100;
+
+    ImageDatabase db(10000);
+    db.load(argv[1]);
+    vector<Image> faces;
+    vector<string> labels;
+    for (int i = 0; i < db.batches(); i++) {
+        Batch<Image> batch = db.batch(i);
+        faces.insert(faces.end(), batch.samples.begin(), batch.samples.end());
+        labels.insert(labels.end(), batch.labels.begin(), batch.labels.end());
+    }
+    cout << faces.size() << " faces loaded." << endl;
+
+    NeuralNetwork nn(NATIVE_NEURAL_NETWORK);
+    vector<Image> samples(faces.begin(), faces.begin() + min(calibration_faces, faces.size()));
+    nn.calibrate(samples);
+    nn.save_calibration(calibration);
+
+    vector<FaceNetEmbed> reps[2];
+    double seconds[2];
+    size_t bytes[2];
+    bytes[0] = nn.weight_bytes();
+    for (int q = 0; q < 2; q++) {
+        nn.set_quantized(q, true);
+        auto start = chrono::steady_clock::now();
+        reps[q] = nn.forward_nn(faces);
+        seconds[q] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    // Embeddings are L2 normalized, so the dot product is the cosine similarity
+    double mean_drift = 0, max_drift = 0;
+    for (size_t i = 0; i < faces.size(); i++) {
+        double drift = 1 - dlib::dot(reps[0][i], reps[1][i]);
+        mean_drift += drift / faces.size();
+        max_drift = max(max_drift, drift);
+    }
+
+    // Train on the float embeddings of every other face, test on the rest
+    vector<FaceNetEmbed> train;
+    vector<string> train_labels;
+    for (size_t i = 0; i < faces.size(); i += 2) {
+        train.push_back(reps[0][i]);
+        train_labels.push_back(labels[i]);
+    }
+    FaceRecognizer fr;
+    fr.train(train, train_labels);
+
+    double accuracy[2] = {0, 0};
+    size_t tests = 0;
+    for (size_t i = 1; i < faces.size(); i += 2, tests++) {
+        for (int q = 0; q < 2; q++)
+            accuracy[q] += fr.recognize(reps[q][i]).first == labels[i];
+    }
+
+    // Switching to int8 for good releases the float weights
+    nn.set_quantized(true);
+    bytes[1] = nn.weight_bytes();
+
+    const char* modes[] = {"float", "int8"};
+    for (int q = 0; q < 2; q++) {
+        cout << modes[q] << ": " << 1000 * seconds[q] / faces.size() << " ms/face, "
+             << bytes[q] / 1024 << " KiB weights, accuracy "
+             << (tests ? accuracy[q] / tests : 0) << endl;
+    }
+    cout << "Cosine drift: mean " << mean_drift << ", max " << max_drift << endl;
+    cout << "Calibration written to " << calibration << endl;
+}
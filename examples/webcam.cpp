@@ -1,5 +1,7 @@
 #include "learning/facerecognizer.hpp"
+#include "learning/identitytracker.hpp"
 #include "detection/facedetector.hpp"
+#include "detection/videosession.hpp"
 #include "openface/openface.hpp"
 #include "database/facedatabase.hpp"
 #include <ctime>
@@ -19,6 +21,8 @@ int main()
             "src/openface/forward_nn.lua", "resources/nn4.v2.t7");
         FaceDetector fd("resources/haarcascade_frontalface_alt.xml",
                         "");
+        // Detect every 10th frame and track the faces in between
+        VideoSession session(fd);
 
         FaceRecognizer fr;
         try {
@@ -30,7 +34,8 @@ int main()
             cout << "Afterwards learn the decision function using ./examples/database_processor" << endl;
             cout << endl << err.what() << endl;
         }
-
+        // Recognize each tracked face only now and then
+        IdentityTracker identities(of, fr);
 
         //Grab and process frames until the main window is closed by the user.
         while(!win.is_closed())
@@ -41,30 +46,23 @@ int main()
 
             Image img(temp);
 
-            Detection detect = fd.dlib_detect(img);
-            if (detect.face.width() == 0) {
-                win.set_image(img.asDLIBImage());
-                continue;
-            }
-            //fa.align(detect);
-            FaceNetEmbed rep = of.facenet(detect);
+            std::vector<Track> tracks = session.process(img);
+            win.clear_overlay();
+            win.set_image(img.asDLIBImage());
+            std::vector<Identity> ids = identities.update(tracks);
 
-            auto df = fr.df();
-            auto result = df.predict(rep);
-            if (result.second > 0.5) {
-                std::stringstream ss;
-                ss << result.first << ", " << result.second;
-                std::string label = ss.str(); //fr.recognize(rep);
-                // Display it all on the screen
-                win.clear_overlay();
-                win.set_image(img.asDLIBImage());
-                win.add_overlay(detect.rect.asDLIBRect(),rgb_pixel(255,0,0), label);
-            }
-            else {
+            for (size_t i = 0; i < ids.size(); i++) {
+                std::string label;
+                if (ids[i].probability > 0.5) {
+                    std::stringstream ss;
+                    ss << ids[i].label << ", " << ids[i].probability;
+                    label = ss.str();
+                }
+                else {
+                    label = std::to_string(ids[i].probability);
+                }
                 // Display it all on the screen
-                win.clear_overlay();
-                win.set_image(img.asDLIBImage());
-                win.add_overlay(detect.rect.asDLIBRect(),rgb_pixel(255,0,0), std::to_string(result.second));
+                win.add_overlay(ids[i].detection.rect.asDLIBRect(),rgb_pixel(255,0,0), label);
             }
         }
     }
@@ -81,8 +81,8 @@ public:
     /**
      * @brief Creates an image from a subsection of an image.
      *
-     * Creates an Image by cloning a region of the original image. In this case
-     * data is actually copied using the OpenCV's clone function.
+     * Creates an Image by copying a region of the original image. Only the
+     * pixels inside the region are copied.
      * Requires the rectangle to be inside the Image.
      *
      * @param img Image from which the region will be extracted
@@ -159,6 +159,10 @@ public:
      * Uses the OpenCV library function to perform an affine transformation on
      * the Image. It also scales the image to the specified size.
      *
+     * Only a padded view of the region that is mapped into the result is
+     * warped, so aligning a face that refers to a whole frame does not copy
+     * the frame. Images sharing the data with this one are not changed.
+     *
      * @param warpMat 2x3 Warp matrix for rotation and translation
      * @param size Required size of the resulting image
      */
@@ -2,6 +2,8 @@
 #define RECTANGLE_HPP
 
 #include <dlib/opencv.h>
+#include <cmath>
+#include <vector>
 
 typedef cv::Rect CVRect;
 typedef dlib::rectangle DLIBRect;
@@ -79,6 +81,28 @@ public:
      */
     long area() const {return width_ * height_;}
 
+    /**
+     * @brief Returns the intersection over union of two rectangles.
+     *
+     * @param other Rectangle to be compared with
+     * @return Area of the intersection divided by the area of the union, 0 if
+     *         both rectangles are empty
+     */
+    double iou(const Rectangle& other) const;
+
+    /**
+     * @brief Returns the Rectangle with all coordinates multiplied by #factor.
+     *
+     * Used to map rectangles between an image and a resized copy of it.
+     *
+     * @param factor Scale factor
+     * @return Scaled and rounded Rectangle
+     */
+    Rectangle scale(double factor) const {
+        return Rectangle(std::round(x_ * factor), std::round(y_ * factor),
+                         std::round(width_ * factor), std::round(height_ * factor));
+    }
+
     /**
      * @brief Returns the Rectanlge as OpenCV's cv::Rect structure.
      *
@@ -106,8 +130,41 @@ inline const CVRect Rectangle::asCVRect() const {
     return CVRect(x_, y_, width_, height_);
 }
 
+inline double Rectangle::iou(const Rectangle& other) const {
+    long intersection = (asCVRect() & other.asCVRect()).area();
+    long total = area() + other.area() - intersection;
+    return total > 0 ? (double)intersection / total : 0;
+}
+
 inline const DLIBRect Rectangle::asDLIBRect() const {
     return DLIBRect(x_, y_, x_+width_-1, y_+height_-1);
 }
 
+/**
+ * @brief Replaces overlapping rectangles by their bounding box until none overlap.
+ *
+ * @param rects Rectangles to be merged
+ * @return Non-overlapping rectangles covering all of #rects
+ */
+inline std::vector<Rectangle> merge_overlapping(const std::vector<Rectangle>& rects) {
+    std::vector<CVRect> out;
+    for (size_t i = 0; i < rects.size(); i++)
+        out.push_back(rects[i].asCVRect());
+
+    for (bool merged = true; merged; ) {
+        merged = false;
+        for (size_t i = 0; i < out.size() && !merged; i++) {
+            for (size_t j = i + 1; j < out.size() && !merged; j++) {
+                if ((out[i] & out[j]).area() > 0) {
+                    out[i] |= out[j];
+                    out.erase(out.begin() + j);
+                    merged = true;
+                }
+            }
+        }
+    }
+
+    return std::vector<Rectangle>(out.begin(), out.end());
+}
+
 #endif
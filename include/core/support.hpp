@@ -7,6 +7,12 @@
 #include <vector>
 #include <cstring>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <new>
+#include <cstdlib>
 
 #define ASSERT(x, msg) if(!!(x)); else {std::cerr << msg; std::abort();}
 
@@ -70,4 +76,105 @@ inline std::vector<std::string> list_directories(const std::string& directory_na
     return out;
 }
 
+/**
+ * @brief Allocator for std::vector whose data starts at a multiple of #Alignment bytes.
+ *
+ * Used for matrices that are read with aligned SIMD loads.
+ */
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {typedef AlignedAllocator<U, Alignment> other;};
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) {
+        void* p = nullptr;
+        if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+            throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t) {
+        free(p);
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const {return true;}
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const {return false;}
+};
+
+/**
+ * @brief Calls f(i, worker) for every i in [0, n) on up to #threads threads.
+ *
+ * Indices are handed out one at a time from a shared counter, so the order in
+ * which they are processed is unspecified and f should write its result to a
+ * position determined by i. The worker argument identifies the calling thread
+ * in [0, threads), which allows f to use per-thread state that is not thread
+ * safe, with worker 0 being the calling thread. With one thread or a single
+ * index everything runs in the calling thread. The first exception thrown by
+ * f is rethrown in the calling thread after all workers have finished.
+ *
+ * @param n Number of indices
+ * @param threads Maximum number of threads to use
+ * @param f Function object taking a size_t index and an int worker
+ */
+template <typename Function>
+void parallel_for_worker(size_t n, int threads, Function f) {
+    if (threads > (int)n)
+        threads = n;
+
+    if (threads <= 1) {
+        for (size_t i = 0; i < n; i++)
+            f(i, 0);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&](int w) {
+        for (size_t i = next++; i < n; i = next++) {
+            try {
+                f(i, w);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++)
+        pool.push_back(std::thread(worker, t));
+    worker(0);
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+/**
+ * @brief Calls f(i) for every i in [0, n) on up to #threads threads.
+ *
+ * @see parallel_for_worker()
+ *
+ * @param n Number of indices
+ * @param threads Maximum number of threads to use
+ * @param f Function object taking a size_t index
+ */
+template <typename Function>
+void parallel_for(size_t n, int threads, Function f) {
+    parallel_for_worker(n, threads, [&f](size_t i, int) { f(i); });
+}
+
 #endif
@@ -3,6 +3,7 @@
 
 #include "../core/rectangle.hpp"
 #include "../openface/face.hpp"
+#include "preparedimage.hpp"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -13,14 +14,64 @@
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/gui_widgets.h>
 
+#include <memory>
+
 /**
  * @brief Container for a face detection.
  *
  * Contains a face and the bounding box of the detected face in the image.
+ * Detections returned by detect_all() refer to the data of the detected
+ * frame, so all faces of a frame share one copy of the pixels.
  */
 struct Detection {
     Image face;
     Rectangle rect;
+
+    /**
+     * @brief Confidence of the detector, larger values are more certain.
+     *
+     * dlib's detection confidence for HOG detections, the level weight of
+     * the last cascade stage for Haarcascade detections. The two scales are
+     * not comparable.
+     */
+    double score;
+
+    /**
+     * @brief Index of the dlib sub-detector that found the face.
+     *
+     * dlib's frontal face detector consists of detectors for frontal faces
+     * and faces turned to the left or right. -1 for Haarcascade detections.
+     */
+    int weight_index;
+
+    Detection() : score(0), weight_index(-1) {}
+};
+
+/**
+ * @brief Removes detections that overlap a detection with a higher score.
+ *
+ * Detections are kept greedily from the highest score down, a detection is
+ * dropped if its intersection over union with a kept one is larger than
+ * #max_overlap.
+ *
+ * @param  ds          Detections, e.g. of several detectors or regions
+ * @param  max_overlap Largest allowed intersection over union
+ * @return             Remaining detections sorted by descending score
+ */
+std::vector<Detection> non_max_suppression(std::vector<Detection> ds, double max_overlap);
+
+/**
+ * @brief Algorithm used by FaceDetector::detect() and FaceDetector::detect_all().
+ */
+enum DetectionMode {
+    /** @brief dlib's HOG detector on the whole image. */
+    HOG,
+    /** @brief OpenCV's Haarcascade classifier on the whole image. */
+    HAAR,
+    /** @brief Haarcascade candidates on a downscaled image, verified by HOG. */
+    CASCADE,
+    /** @brief dlib's HOG detector with the pyramid levels scanned in parallel. */
+    HOG_PARALLEL
 };
 
 /**
@@ -61,7 +112,7 @@ public:
     void load(const std::string& cpu_path, const std::string& gpu_path);
 
     /**
-     * @brief Detects an image using the a combination of the algorithms.
+     * @brief Detects an image using the algorithm selected with set_mode().
      * @param  img Image in which the face shall be detected.
      * @return     Detection of the face, if no face found the detection has an
      *             empty rectangle
@@ -70,13 +121,151 @@ public:
     /**
      * @brief Detects faces in multiple images.
      *
-     * Internally calls detect() for each image.
+     * Internally calls detect() for each image, distributing the images over
+     * threads(). Neither dlib's detector nor the cv::CascadeClassifier is
+     * thread safe, so every additional thread uses its own FaceDetector. These
+     * are created on first use and kept for later calls. If the images are
+     * spread over several threads, the pyramid levels of each image are
+     * scanned serially, also in HOG_PARALLEL mode.
      *
      * @param  imgs Images in which face shall be detected.
-     * @return Detections of faces
+     * @return Detections of faces, in the same order as #imgs
      */
     std::vector<Detection> detect(const std::vector<Image>& imgs);
 
+    /**
+     * @brief Detects all faces in an image using a single detector pass.
+     *
+     * Internally calls dlib_detect_all(), dlib_parallel_detect_all(),
+     * cv_detect_all() or cascade_detect_all() depending on mode().
+     *
+     * @param  img Image in which the faces shall be detected.
+     * @return     Detections of all faces, empty if no face was found
+     */
+    std::vector<Detection> detect_all(const Image& img);
+
+    /**
+     * @brief Detects all faces inside a region of an image.
+     *
+     * Runs the dlib detector only on the pixels of #region, without copying
+     * them. Faces crossing the border of the region are usually not found, so
+     * the region should include some margin around the expected faces.
+     *
+     * @param  img    Image in which the faces shall be detected.
+     * @param  region Part of #img to be searched, clipped to the image
+     * @return        Detections of all faces in coordinates of #img
+     */
+    std::vector<Detection> detect_all(const Image& img, const Rectangle& region);
+
+    /**
+     * @brief Detects all faces on a prepared grayscale pyramid.
+     *
+     * Uses the algorithm selected with set_mode(). The HOG detector scans
+     * every level of #img that is not larger than scale() with a copy of the
+     * detector restricted to a single pyramid level, instead of building its
+     * own pyramid, and the detections of all levels are merged with the
+     * detector's overlap tester. In HOG_PARALLEL mode the levels are scanned
+     * on up to threads() threads. The Haarcascade runs on the grayscale frame,
+     * in cascade mode on the pyramid level closest to cascade_scale().
+     *
+     * HOG gradients are computed on intensities instead of the strongest
+     * color channel, so scores differ slightly from detect_all(const Image&).
+     *
+     * @param  img Prepared frame, the detections refer to img.image()
+     * @return     Detections of all faces, empty if no face was found
+     */
+    std::vector<Detection> detect_all(const PreparedImage& img);
+
+    /**
+     * @brief Sets the number of threads used to detect faces in multiple images.
+     *
+     * In HOG_PARALLEL mode the threads also scan the pyramid levels of a
+     * single image, except in detect(const std::vector<Image>&), where the
+     * threads already work on different images.
+     *
+     * @param threads Number of threads, 1 to detect in the calling thread only
+     */
+    void set_threads(int threads);
+
+    /**
+     * @brief Returns the number of threads used to detect faces in multiple images.
+     */
+    int threads() const {return threads_;}
+
+    /**
+     * @brief Sets the scale of the image the dlib detector runs on.
+     *
+     * With a scale below 1 the frame is downscaled before detection, which
+     * makes the detection on large frames much faster but misses faces that
+     * become smaller than the detector window of DETECTOR_WINDOW_SIZE pixels.
+     * The returned rectangles are always in coordinates of the original frame,
+     * so alignment uses the full resolution pixels.
+     *
+     * @param scale Scale factor in (0, 1], 1 detects on the original frame
+     */
+    void set_scale(double scale);
+
+    /**
+     * @brief Sets the scale such that faces of the given size are still found.
+     *
+     * Faces of #size pixels are scaled to the detector window size, the scale
+     * is never larger than 1. Detections narrower than #size are dropped,
+     * also if the scale is changed later with set_scale().
+     *
+     * @param size Smallest face width in pixels of the original frame
+     */
+    void set_min_face_size(int size);
+
+    /**
+     * @brief Returns the smallest face width that is not dropped.
+     */
+    int min_face_size() const {return min_face_size_;}
+
+    /**
+     * @brief Returns the scale of the image the dlib detector runs on.
+     */
+    double scale() const {return scale_;}
+
+    /**
+     * @brief Sets the minimum score of HOG detections.
+     *
+     * Passed on as adjust_threshold to dlib's detector, so weak detections
+     * are rejected before alignment and embedding. Negative values return
+     * more, less certain faces.
+     *
+     * @param threshold Minimum detection confidence, 0 by default
+     */
+    void set_score_threshold(double threshold) {score_threshold_ = threshold;}
+
+    /**
+     * @brief Returns the minimum score of HOG detections.
+     */
+    double score_threshold() const {return score_threshold_;}
+
+    /**
+     * @brief Sets the minimum score of Haarcascade detections and candidates.
+     * @param threshold Minimum level weight, no limit by default
+     */
+    void set_haar_score_threshold(double threshold) {haar_score_threshold_ = threshold;}
+
+    /**
+     * @brief Returns the minimum score of Haarcascade detections and candidates.
+     */
+    double haar_score_threshold() const {return haar_score_threshold_;}
+
+    /**
+     * @brief Sets the overlap above which the weaker of two detections is dropped.
+     *
+     * @param max_overlap Intersection over union, 0.5 by default
+     * @see non_max_suppression()
+     */
+    void set_nms_threshold(double max_overlap) {nms_threshold_ = max_overlap;}
+
+    /**
+     * @brief Returns the overlap above which the weaker of two detections is dropped.
+     */
+    double nms_threshold() const {return nms_threshold_;}
+
     /**
      * @brief Detects an image using the the dlib algorithms.
      * @param  img Image in which the face shall be detected.
@@ -85,6 +274,33 @@ public:
      */
     Detection dlib_detect(const Image& img);
 
+    /**
+     * @brief Detects all faces in an image using the dlib algorithms.
+     *
+     * Every detection refers to #img instead of holding a copy of it.
+     *
+     * @param  img Image in which the faces shall be detected.
+     * @return     Detections of all faces, empty if no face was found
+     */
+    std::vector<Detection> dlib_detect_all(const Image& img);
+
+    /**
+     * @brief Detects all faces with the pyramid levels scanned on threads() threads.
+     *
+     * dlib scans the levels of its image pyramid one after another, so the
+     * latency of a single large frame does not improve with more cores. Here
+     * every level is scanned by the detector of a worker thread and the
+     * levels are merged like dlib does, so the detections equal those of
+     * dlib_detect_all() up to the order of exactly equal scores.
+     *
+     * The first level takes about a third of the work, which bounds the
+     * speedup to about three.
+     *
+     * @param  img Image in which the faces shall be detected.
+     * @return     Detections of all faces, empty if no face was found
+     */
+    std::vector<Detection> dlib_parallel_detect_all(const Image& img);
+
 #ifdef CUDA_SUPPORT
     void gpu_detect(const cv::cuda::GpuMat& img);
 #endif
@@ -97,6 +313,65 @@ public:
      *             empty rectangle
      */
     Detection cv_detect(const Image& img);
+
+    /**
+     * @brief Detects all faces in an image using the Haarcascade approach.
+     *
+     * Every detection refers to #img instead of holding a copy of it.
+     *
+     * @param  img Image in which the faces shall be detected.
+     * @return     Detections of all faces, empty if no face was found
+     */
+    std::vector<Detection> cv_detect_all(const Image& img);
+
+    /**
+     * @brief Detects all faces with Haarcascade proposals verified by HOG.
+     *
+     * The Haarcascade classifier proposes candidates on the image downscaled
+     * by cascade_scale(). The HOG detector then only runs on the candidates,
+     * padded by half their size and merged where they overlap, so a face is
+     * returned only if both detectors agree. This gives HOG precision at
+     * roughly the cost of the Haarcascade. Faces the Haarcascade misses are
+     * lost, unless set_fallback() enables a full HOG scan for frames without
+     * any verified face.
+     *
+     * @param  img Image in which the faces shall be detected.
+     * @return     Detections of all faces, empty if no face was found
+     */
+    std::vector<Detection> cascade_detect_all(const Image& img);
+
+    /**
+     * @brief Selects the algorithm used by detect() and detect_all().
+     * @param mode Detection algorithm, HOG by default
+     */
+    void set_mode(DetectionMode mode);
+
+    /**
+     * @brief Returns the algorithm used by detect() and detect_all().
+     */
+    DetectionMode mode() const {return mode_;}
+
+    /**
+     * @brief Sets the scale of the image the Haarcascade proposes candidates on.
+     * @param scale Scale factor in (0, 1]
+     */
+    void set_cascade_scale(double scale);
+
+    /**
+     * @brief Returns the scale of the image the Haarcascade proposes candidates on.
+     */
+    double cascade_scale() const {return cascade_scale_;}
+
+    /**
+     * @brief Enables a full HOG scan if the cascade does not find a face.
+     * @param fallback True to fall back to dlib_detect_all()
+     */
+    void set_fallback(bool fallback) {fallback_ = fallback;}
+
+    /**
+     * @brief Returns true if the cascade falls back to a full HOG scan.
+     */
+    bool fallback() const {return fallback_;}
 private:
 
     /**
@@ -104,6 +379,12 @@ private:
      */
     dlib::frontal_face_detector detector;
 
+    /**
+     * @brief Copy of #detector without pyramid, created on first use.
+     */
+    dlib::frontal_face_detector single_level_;
+    bool single_level_ready_;
+
     /**
      * @brief OpenCV Haarcascade classifier.
      */
@@ -119,6 +400,107 @@ private:
      */
     bool verifyDetection(const Image& img, const Rectangle& rect);
 
+    /**
+     * @brief Runs the dlib detector on the image downscaled by #scale_.
+     *
+     * @return Scored candidates in coordinates of #img, without face
+     */
+    std::vector<Detection> dlib_candidates(const Image& img);
+
+    /**
+     * @brief Returns the HOG regions to verify for the Haarcascade candidates.
+     *
+     * @param candidates Candidates found on an image scaled by #scale
+     * @param scale Scale of the image the candidates were found on
+     */
+    std::vector<Rectangle> cascade_regions(const std::vector<Detection>& candidates, double scale) const;
+
+    /**
+     * @brief Runs the dlib detector on a region of the image downscaled by #scale_.
+     *
+     * @return Scored candidates in coordinates of the full image, without face
+     */
+    std::vector<Detection> dlib_candidates(const Image& img, const Rectangle& region);
+
+    /**
+     * @brief Runs the single level dlib detector on every level of #img.
+     *
+     * In HOG_PARALLEL mode the levels are spread over the workers.
+     *
+     * @return Scored candidates in coordinates of the frame, without face
+     */
+    std::vector<Detection> dlib_candidates(const PreparedImage& img);
+
+    /**
+     * @brief Returns a copy of #detector that only scans the given image.
+     */
+    dlib::frontal_face_detector& single_level_detector();
+
+    /**
+     * @brief Runs the Haarcascade and keeps candidates above the score threshold.
+     *
+     * @return Scored candidates in coordinates of #img, without face
+     */
+    std::vector<Detection> cv_candidates(cv::InputArray img, int min_neighbors, int min_size);
+
+    /**
+     * @brief Turns the valid candidates into detections sharing #img.
+     *
+     * Drops candidates outside of the image or smaller than the minimum face
+     * size and applies non_max_suppression().
+     */
+    std::vector<Detection> detections(const Image& img, const std::vector<Detection>& candidates);
+
+    /**
+     * @brief Returns the detector used by the given worker thread.
+     *
+     * Worker 0 is this detector, the others are taken from #workers_.
+     */
+    FaceDetector& worker(int i);
+
+    /**
+     * @brief Copies all detection settings of #other.
+     */
+    void copy_settings(const FaceDetector& other);
+
+    /**
+     * @brief Makes sure there are detectors for #threads worker threads.
+     */
+    void create_workers(int threads);
+
+    /**
+     * @brief Scans the pyramid levels of #img on up to #threads_ threads.
+     *
+     * Builds the same color pyramid as dlib's scanner, runs the single level
+     * detector of a worker on each level and merges the levels with the
+     * overlap tester of #detector.
+     *
+     * @return Detections in coordinates of #img, sorted by descending score
+     */
+    std::vector<dlib::rect_detection> parallel_scan(const dlib::cv_image<dlib::bgr_pixel>& img);
+
+    /**
+     * @brief Path of the loaded haarcascade, used to load the worker detectors.
+     */
+    std::string cpu_path_;
+
+    /**
+     * @brief Detectors of the additional threads of detect(const std::vector<Image>&).
+     */
+    std::vector<std::shared_ptr<FaceDetector> > workers_;
+
+    int threads_;
+
+    double scale_;
+    int min_face_size_;
+    double score_threshold_;
+    double haar_score_threshold_;
+    double nms_threshold_;
+
+    DetectionMode mode_;
+    double cascade_scale_;
+    bool fallback_;
+
     bool gpuEnabled;
     bool initialized_;
 };
@@ -0,0 +1,103 @@
+#ifndef MOTIONGATE_HPP
+#define MOTIONGATE_HPP
+
+#include "facedetector.hpp"
+
+/**
+ * @brief Skips face detection on the parts of a frame that did not change.
+ *
+ * Cameras watching a mostly static scene produce many frames that are nearly
+ * identical. The MotionGate compares every frame with the frame the current
+ * detections were made on, using a downscaled grayscale copy of both:
+ *
+ * - If fewer than min_pixels (see the constructor) pixels changed by more
+ *   than threshold(), the previous detections are reused and the detector
+ *   does not run at all, which counts as a hit.
+ * - Otherwise the changed pixels are grouped into regions, which are padded
+ *   and passed to FaceDetector::detect_all(const Image&, const Rectangle&).
+ *   Previous detections outside of all regions are kept.
+ *
+ * hit_rate() reports the fraction of frames on which detection was skipped.
+ */
+class MotionGate {
+public:
+    /**
+     * @brief Constructs a gate in front of the given detector.
+     *
+     * @param fd Detector used on changed regions, must outlive the gate
+     * @param scale Scale of the grayscale images that are compared
+     * @param threshold Minimum change of a gray value to count as motion
+     * @param min_pixels Number of changed pixels in the downscaled image
+     *        below which the frame counts as unchanged, to ignore noise
+     */
+    MotionGate(FaceDetector& fd, double scale = 0.25, int threshold = 25, int min_pixels = 4);
+
+    /**
+     * @brief Default destructor.
+     */
+    ~MotionGate() {}
+
+    /**
+     * @brief Detects all faces in the next frame, reusing unchanged detections.
+     *
+     * @param  frame Next frame, the returned detections refer to its data
+     * @return       Detections of all faces
+     */
+    std::vector<Detection> detect_all(const Image& frame);
+
+    /**
+     * @brief Forgets the reference frame, the next frame is fully detected.
+     */
+    void reset();
+
+    /**
+     * @brief Returns the number of frames passed to detect_all().
+     */
+    size_t frames() const {return frames_;}
+
+    /**
+     * @brief Returns the number of frames on which detection was skipped.
+     */
+    size_t hits() const {return hits_;}
+
+    /**
+     * @brief Returns the fraction of frames on which detection was skipped.
+     */
+    double hit_rate() const {return frames_ ? (double)hits_ / frames_ : 0;}
+
+    /**
+     * @brief Returns the minimum change of a gray value to count as motion.
+     */
+    int threshold() const {return threshold_;}
+
+private:
+    /**
+     * @brief Returns the downscaled grayscale copy of #frame.
+     */
+    cv::Mat small(const Image& frame) const;
+
+    /**
+     * @brief Returns the padded bounding boxes of the changed areas of #mask.
+     *
+     * @param mask Changed pixels of the downscaled image
+     * @param frame Full size frame
+     * @return Regions in full size coordinates, overlapping regions merged
+     */
+    std::vector<Rectangle> regions(cv::Mat& mask, const Image& frame) const;
+
+    FaceDetector& fd_;
+    double scale_;
+    int threshold_;
+    int min_pixels_;
+
+    /**
+     * @brief Downscaled grayscale frame the current detections were made on.
+     */
+    cv::Mat reference_;
+
+    std::vector<Detection> detections_;
+    size_t frames_;
+    size_t hits_;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef PREPAREDIMAGE_HPP
+#define PREPAREDIMAGE_HPP
+
+#include "../core/image.hpp"
+#include "../openface/settings.hpp"
+
+#include <dlib/array.h>
+#include <dlib/array2d.h>
+#include <dlib/image_transforms.h>
+
+typedef dlib::array2d<unsigned char> GrayImage;
+
+/**
+ * @brief Grayscale image pyramid of a frame, computed once per frame.
+ *
+ * dlib's HOG detector, the Haarcascade and the shape predictor all work on
+ * intensities and would each convert the color frame and build their own
+ * pyramid. A PreparedImage does the conversion and the resampling once, and
+ * FaceDetector and FaceAligner accept it in place of the Image.
+ *
+ * Level 0 is the grayscale frame, every following level is downscaled by
+ * dlib's pyramid_down<6>, i.e. to 5/6 of the previous level, like the
+ * pyramid of dlib's frontal face detector.
+ */
+class PreparedImage {
+public:
+    typedef dlib::pyramid_down<6> Pyramid;
+
+    /**
+     * @brief Converts the frame to grayscale and builds the pyramid.
+     *
+     * @param img Frame, the PreparedImage refers to its data
+     * @param min_size Levels are added while both sides are at least this long
+     */
+    PreparedImage(const Image& img, int min_size = DETECTOR_WINDOW_SIZE);
+
+    /**
+     * @brief Returns the color frame the pyramid was built from.
+     */
+    const Image& image() const {return image_;}
+
+    /**
+     * @brief Returns the grayscale frame, i.e. level(0).
+     */
+    const GrayImage& gray() const {return levels_[0];}
+
+    /**
+     * @brief Returns the grayscale frame as OpenCV matrix without copying.
+     */
+    cv::Mat gray_mat() const {return level_mat(0);}
+
+    /**
+     * @brief Returns the number of pyramid levels.
+     */
+    size_t levels() const {return levels_.size();}
+
+    /**
+     * @brief Returns a level of the pyramid.
+     * @param i Level, 0 is the full resolution
+     */
+    const GrayImage& level(size_t i) const {return levels_[i];}
+
+    /**
+     * @brief Returns a level of the pyramid as OpenCV matrix without copying.
+     * @param i Level, 0 is the full resolution
+     */
+    cv::Mat level_mat(size_t i) const;
+
+    /**
+     * @brief Returns the size of a level relative to the frame.
+     * @param i Level, 0 is the full resolution
+     */
+    double scale(size_t i) const {return (double)levels_[i].nc() / levels_[0].nc();}
+
+    /**
+     * @brief Maps a rectangle found on a level to coordinates of the frame.
+     *
+     * @param rect Rectangle in coordinates of level #i
+     * @param i Level the rectangle was found on
+     * @return Rectangle in coordinates of the frame
+     */
+    Rectangle to_image(const DLIBRect& rect, size_t i) const;
+
+private:
+    Image image_;
+    dlib::array<GrayImage> levels_;
+    Pyramid pyramid_;
+};
+
+#endif
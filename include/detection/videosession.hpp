@@ -0,0 +1,168 @@
+#ifndef VIDEOSESSION_HPP
+#define VIDEOSESSION_HPP
+
+#include "facedetector.hpp"
+
+#include <dlib/image_processing/correlation_tracker.h>
+
+/**
+ * @brief A face followed through the frames of a VideoSession.
+ */
+struct Track {
+    /**
+     * @brief Identifier of the face, unique within the session.
+     */
+    int id;
+
+    /**
+     * @brief Position of the face in the current frame.
+     */
+    Detection detection;
+
+    /**
+     * @brief Peak-to-sidelobe ratio of the last tracker update.
+     *
+     * Infinity if the face was detected in the current frame.
+     */
+    double confidence;
+};
+
+/**
+ * @brief Follows faces through a video, detecting only on keyframes.
+ *
+ * Running the FaceDetector on every frame of a live stream is expensive,
+ * while the faces barely move between two frames. A VideoSession runs the
+ * detector only every keyframe_interval() frames and follows the faces in
+ * between with dlib's correlation tracker, which only looks at a search
+ * window around the last position of each face.
+ *
+ * If the confidence of any tracker drops below min_confidence(), e.g. because
+ * a face was occluded or moved too fast, the frame is treated as a keyframe.
+ * On keyframes detections are matched to the existing tracks by their
+ * intersection over union, so the faces keep their id, new faces start a new
+ * track and faces that were not detected anymore are dropped. While there is
+ * no track the detector runs every empty_interval() frames, so a new face is
+ * found with the same delay as on a frame with faces by default.
+ */
+class VideoSession {
+public:
+    /**
+     * @brief Constructs a session detecting with the given detector.
+     *
+     * @param fd Detector used on keyframes, must outlive the session
+     * @param keyframe_interval Number of frames from one keyframe to the next
+     * @param min_confidence Tracker confidence below which a keyframe is forced
+     */
+    VideoSession(FaceDetector& fd, int keyframe_interval = 10, double min_confidence = 7);
+
+    /**
+     * @brief Default destructor.
+     */
+    ~VideoSession() {}
+
+    /**
+     * @brief Finds the faces in the next frame of the video.
+     *
+     * @param  frame Next frame, the returned detections refer to its data
+     * @return       Tracks of all faces in the frame
+     */
+    std::vector<Track> process(const Image& frame);
+
+    /**
+     * @brief Returns the tracks of the last processed frame.
+     */
+    std::vector<Track> tracks() const;
+
+    /**
+     * @brief Returns true if the detector ran on the last processed frame.
+     */
+    bool keyframe() const {return keyframe_;}
+
+    /**
+     * @brief Forgets all tracks, the next frame will be a keyframe.
+     */
+    void reset();
+
+    /**
+     * @brief Sets the number of frames from one keyframe to the next.
+     * @param interval Keyframe interval, 1 detects on every frame
+     */
+    void set_keyframe_interval(int interval);
+
+    /**
+     * @brief Returns the number of frames from one keyframe to the next.
+     */
+    int keyframe_interval() const {return keyframe_interval_;}
+
+    /**
+     * @brief Sets the number of frames from one keyframe to the next while
+     *        no face is tracked.
+     *
+     * Equals the keyframe interval passed to the constructor by default.
+     * Smaller values find faces entering an empty scene sooner.
+     *
+     * @param interval Empty scene interval, 1 detects on every frame without faces
+     */
+    void set_empty_interval(int interval);
+
+    /**
+     * @brief Returns the number of frames from one keyframe to the next while
+     *        no face is tracked.
+     */
+    int empty_interval() const {return empty_interval_;}
+
+    /**
+     * @brief Sets the tracker confidence below which a keyframe is forced.
+     * @param confidence Minimum peak-to-sidelobe ratio
+     */
+    void set_min_confidence(double confidence) {min_confidence_ = confidence;}
+
+    /**
+     * @brief Returns the tracker confidence below which a keyframe is forced.
+     */
+    double min_confidence() const {return min_confidence_;}
+
+    /**
+     * @brief Minimum intersection over union of a detection and a track to
+     *        be considered the same face.
+     */
+    static constexpr double MIN_OVERLAP = 0.3;
+
+private:
+    /**
+     * @brief A face followed by a correlation tracker.
+     */
+    struct State {
+        int id;
+        dlib::correlation_tracker tracker;
+        Rectangle rect;
+        double confidence;
+    };
+
+    /**
+     * @brief Moves all tracks to their position in #frame.
+     * @return False if any tracker lost its face
+     */
+    bool update(const Image& frame);
+
+    /**
+     * @brief Detects the faces in #frame and matches them to the tracks.
+     */
+    void detect(const Image& frame);
+
+    FaceDetector& fd_;
+    std::vector<State> states_;
+    Image frame_;
+    int keyframe_interval_;
+    int empty_interval_;
+    double min_confidence_;
+
+    /**
+     * @brief Frames processed since the last keyframe, -1 before the first frame.
+     */
+    int frames_since_keyframe_;
+    int next_id_;
+    bool keyframe_;
+};
+
+#endif
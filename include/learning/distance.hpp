@@ -0,0 +1,88 @@
+#ifndef DISTANCE_HPP
+#define DISTANCE_HPP
+
+#include <cstddef>
+
+/**
+ * @brief Computes the squared euclidean distances of a query to a set of rows.
+ *
+ * This is the inner loop of the nearest neighbour search over FaceNet
+ * embeddings. The rows are stored one after another with #dims floats each.
+ * The fastest kernel supported by the CPU is selected at runtime (AVX-512,
+ * AVX2 or the scalar loop). The kernels sum in a different order, so their
+ * results differ in the last bits.
+ *
+ * @param query Pointer to #dims floats
+ * @param rows Pointer to n*dims floats
+ * @param n Number of rows
+ * @param dims Number of floats per row
+ * @param out Destination of the n distances
+ */
+void squared_distances(const float* query, const float* rows, size_t n, size_t dims, float* out);
+
+/**
+ * @brief Scalar reference implementation of squared_distances().
+ */
+void squared_distances_scalar(const float* query, const float* rows, size_t n, size_t dims, float* out);
+
+/**
+ * @brief AVX2 implementation of squared_distances().
+ *
+ * Must only be called if squared_distances_supported("avx2") is true.
+ */
+void squared_distances_avx2(const float* query, const float* rows, size_t n, size_t dims, float* out);
+
+/**
+ * @brief AVX-512 implementation of squared_distances().
+ *
+ * Must only be called if squared_distances_supported("avx512f") is true.
+ */
+void squared_distances_avx512(const float* query, const float* rows, size_t n, size_t dims, float* out);
+
+/**
+ * @brief Computes the dot products of a query with a set of rows.
+ *
+ * Used to score an embedding against the weight vectors of linear
+ * classifiers. The rows are stored like for squared_distances() and the
+ * kernel is selected the same way.
+ *
+ * @param query Pointer to #dims floats
+ * @param rows Pointer to n*dims floats
+ * @param n Number of rows
+ * @param dims Number of floats per row
+ * @param out Destination of the n dot products
+ */
+void dot_products(const float* query, const float* rows, size_t n, size_t dims, float* out);
+
+/**
+ * @brief Scalar reference implementation of dot_products().
+ */
+void dot_products_scalar(const float* query, const float* rows, size_t n, size_t dims, float* out);
+
+/**
+ * @brief AVX2 implementation of dot_products().
+ *
+ * Must only be called if squared_distances_supported("avx2") is true.
+ */
+void dot_products_avx2(const float* query, const float* rows, size_t n, size_t dims, float* out);
+
+/**
+ * @brief AVX-512 implementation of dot_products().
+ *
+ * Must only be called if squared_distances_supported("avx512f") is true.
+ */
+void dot_products_avx512(const float* query, const float* rows, size_t n, size_t dims, float* out);
+
+/**
+ * @brief Returns true if the kernel for the given instruction set can run here.
+ *
+ * @param isa One of "scalar", "avx2" or "avx512f"
+ */
+bool squared_distances_supported(const char* isa);
+
+/**
+ * @brief Returns the name of the instruction set used by squared_distances().
+ */
+const char* squared_distances_isa();
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef EMBEDDINGINDEX_HPP
+#define EMBEDDINGINDEX_HPP
+
+#include "../openface/neuralnetwork.hpp"
+#include "../core/support.hpp"
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <cstdint>
+
+/**
+ * @brief Number of floats of a FaceNetEmbed.
+ */
+static const size_t EMBEDDING_DIMS = FaceNetEmbed::NR;
+
+/**
+ * @brief Result of a nearest neighbour search.
+ */
+struct Neighbor {
+    /** @brief Position of the embedding in the order it was added to the index. */
+    size_t id;
+    /** @brief Squared euclidean distance to the query. */
+    float distance;
+
+    Neighbor() : id(0), distance(0) {}
+    Neighbor(size_t i, float d) : id(i), distance(d) {}
+
+    bool operator<(const Neighbor& other) const {
+        return distance < other.distance || (distance == other.distance && id < other.id);
+    }
+};
+
+/**
+ * @brief Interface of the nearest neighbour indices over FaceNet embeddings.
+ *
+ * Embeddings are identified by the order in which they were added, so a
+ * FaceRecognizer can keep the labels in a vector next to the index.
+ */
+class EmbeddingIndex {
+public:
+    virtual ~EmbeddingIndex() {}
+
+    /**
+     * @brief Adds an embedding, its id is the size() before the call.
+     */
+    virtual void add(const FaceNetEmbed& embedding) =0;
+
+    /**
+     * @brief Adds a set of embeddings in order.
+     */
+    virtual void add(const std::vector<FaceNetEmbed>& embeddings);
+
+    /**
+     * @brief Returns the number of embeddings in the index.
+     */
+    virtual size_t size() const =0;
+
+    /**
+     * @brief Finds the nearest embeddings of #query.
+     *
+     * @param query Embedding to search for
+     * @param k Number of neighbours
+     * @return Up to #k neighbours sorted by ascending distance
+     */
+    virtual std::vector<Neighbor> search(const FaceNetEmbed& query, size_t k) const =0;
+};
+
+/**
+ * @brief Exact nearest neighbour search by comparing the query to every embedding.
+ *
+ * The embeddings are stored in one contiguous, 64 byte aligned row major
+ * matrix, so the scan streams through memory and every row starts on a cache
+ * line. The distances are computed with squared_distances(), which uses
+ * AVX-512 or AVX2 where available. Large galleries are split into shards that
+ * are scanned on up to threads() threads, each keeping its own top k, which
+ * are merged at the end.
+ */
+class BruteForceIndex : public EmbeddingIndex {
+public:
+    /**
+     * @brief Creates an empty index searching on all cores.
+     */
+    BruteForceIndex();
+
+    using EmbeddingIndex::add;
+    virtual void add(const FaceNetEmbed& embedding);
+
+    virtual size_t size() const {return data_.size() / EMBEDDING_DIMS;}
+
+    virtual std::vector<Neighbor> search(const FaceNetEmbed& query, size_t k) const;
+
+    /**
+     * @brief Reserves memory for #n embeddings.
+     */
+    void reserve(size_t n) {data_.reserve(n * EMBEDDING_DIMS);}
+
+    /**
+     * @brief Returns the embedding with the given id.
+     */
+    const float* embedding(size_t id) const {return data_.data() + id * EMBEDDING_DIMS;}
+
+    /**
+     * @brief Sets the number of threads used by search().
+     * @param threads Number of threads, 1 to search in the calling thread only
+     */
+    void set_threads(int threads);
+
+    /**
+     * @brief Returns the number of threads used by search().
+     */
+    int threads() const {return threads_;}
+
+private:
+    /**
+     * @brief Smallest number of embeddings scanned by one thread.
+     */
+    static const size_t MIN_SHARD_SIZE = 4096;
+
+    std::vector<float, AlignedAllocator<float, 64> > data_;
+
+    int threads_;
+};
+
+/**
+ * @brief Approximate nearest neighbour search on a hierarchical navigable small world graph.
+ *
+ * Every embedding is a node of a layered proximity graph (Malkov and Yashunin,
+ * HNSW). A search descends greedily from the sparse top layer and explores
+ * the ef() closest nodes on the bottom layer, so it visits a small fraction of
+ * the gallery. Larger ef() values give a higher recall at a lower speed.
+ *
+ * Embeddings can be added one at a time at any point. add(const
+ * std::vector<FaceNetEmbed>&) inserts on up to threads() threads, every node
+ * has its own lock for its links. Searches must not run concurrently with
+ * inserts, but any number of searches may run at the same time.
+ */
+class HNSWIndex : public EmbeddingIndex {
+public:
+    /**
+     * @brief Creates an empty index.
+     *
+     * @param M Number of links per node and layer, twice as many on the bottom layer
+     * @param ef_construction Number of candidates explored to link a new node
+     * @param seed Seed of the random layer assignment
+     */
+    HNSWIndex(size_t M = 16, size_t ef_construction = 200, unsigned long seed = 0);
+
+    virtual void add(const FaceNetEmbed& embedding);
+
+    /**
+     * @brief Inserts a set of embeddings on up to threads() threads.
+     *
+     * Ids are assigned in order, but the graph depends on the order in which
+     * the threads insert the nodes.
+     */
+    virtual void add(const std::vector<FaceNetEmbed>& embeddings);
+
+    virtual size_t size() const {return levels_.size();}
+
+    virtual std::vector<Neighbor> search(const FaceNetEmbed& query, size_t k) const;
+
+    /**
+     * @brief Sets the number of candidates explored by search(), at least k.
+     */
+    void set_ef(size_t ef);
+
+    /**
+     * @brief Returns the number of candidates explored by search().
+     */
+    size_t ef() const {return ef_;}
+
+    /**
+     * @brief Sets the number of threads used to insert a set of embeddings.
+     * @param threads Number of threads, 1 to insert in the calling thread only
+     */
+    void set_threads(int threads);
+
+    /**
+     * @brief Returns the number of threads used to insert a set of embeddings.
+     */
+    int threads() const {return threads_;}
+
+    /**
+     * @brief Writes the parameters, the embeddings and the graph to a file.
+     *
+     * @param path File to write
+     * @throw std::runtime_error "Directory does not exist: ${path}"
+     */
+    void save(const std::string& path) const;
+
+    /**
+     * @brief Replaces the index with one written by save().
+     *
+     * The graph is validated before it replaces the index, so a corrupt file
+     * leaves the index unchanged.
+     *
+     * @param path File to read
+     * @throw std::runtime_error if the file does not exist or is no valid index
+     */
+    void load(const std::string& path);
+
+private:
+    typedef uint32_t NodeId;
+
+    /**
+     * @brief Appends an embedding and draws its layer without linking it.
+     */
+    void append(const FaceNetEmbed& embedding);
+
+    /**
+     * @brief Links an appended node into the graph.
+     */
+    void insert(NodeId id);
+
+    /**
+     * @brief Returns the squared distance of #query to a node.
+     */
+    float distance(const float* query, NodeId id) const;
+
+    /**
+     * @brief Returns the #ef closest nodes to #query reachable on a layer.
+     *
+     * @return Nodes sorted by ascending distance
+     */
+    std::vector<Neighbor> search_layer(const float* query, NodeId entry, size_t ef, int level) const;
+
+    /**
+     * @brief Keeps up to #m candidates that are closer to the node than to each other.
+     *
+     * @param candidates Neighbours of the node with their distances to it
+     */
+    std::vector<NodeId> select_neighbors(std::vector<Neighbor> candidates, size_t m) const;
+
+    /**
+     * @brief Adds links of #id on a layer, pruning them to the allowed number.
+     *
+     * Must be called with the lock of #id held.
+     */
+    void link(NodeId id, int level, const std::vector<NodeId>& others);
+
+    /**
+     * @brief Returns the number of links a node may have on a layer.
+     */
+    size_t max_links(int level) const {return level == 0 ? 2 * M_ : M_;}
+
+    size_t M_;
+    size_t ef_construction_;
+    size_t ef_;
+    int threads_;
+
+    std::vector<float, AlignedAllocator<float, 64> > data_;
+
+    /**
+     * @brief Top layer of every node.
+     */
+    std::vector<int> levels_;
+
+    /**
+     * @brief Links of every node on each of its layers.
+     */
+    std::vector<std::vector<std::vector<NodeId> > > links_;
+
+    /**
+     * @brief Lock of the links of every node.
+     */
+    mutable std::deque<std::mutex> locks_;
+
+    /**
+     * @brief Protects #entry_ and #max_level_.
+     */
+    mutable std::mutex entry_mutex_;
+    NodeId entry_;
+    int max_level_;
+
+    std::mt19937 rng_;
+};
+
+#endif
@@ -3,13 +3,14 @@
 
 #include "../database/facedatabase.hpp"
 #include "../openface/neuralnetwork.hpp"
+#include "embeddingindex.hpp"
+#include "linearscorer.hpp"
 
 #include <dlib/svm.h>
 #include <dlib/svm/one_vs_one_trainer.h>
 #include <dlib/svm/one_vs_all_trainer.h>
 
-typedef dlib::linear_kernel<FaceNetEmbed> linear_kernel;
-typedef dlib::one_vs_all_trainer<dlib::any_trainer<FaceNetEmbed, float>, std::string> ova_trainer;
+#include <memory>
 
 /**
  * @brief Class to train and use a decision function for face recognition.
@@ -18,7 +19,13 @@ typedef dlib::one_vs_all_trainer<dlib::any_trainer<FaceNetEmbed, float>, std::st
  * of faces based on a set of labeled facerepresentations. The recognizer uses
  * FaceNet embeddings (128-byte vectors) for the decision function and as input
  * and outputs a name.
- * The decision function is trained using an SVM with a linear kernel.
+ * The decision function is trained using an SVM with a linear kernel and
+ * compiled into a LinearScorer, which is used for the recognition.
+ *
+ * Alternatively an EmbeddingIndex can be set with set_index(). The recognizer
+ * then keeps all embeddings and labels a face with the majority of its
+ * nearest neighbours. New people are added with add() without retraining,
+ * and faces without a neighbour closer than max_distance() are UNKNOWN.
  */
 class FaceRecognizer {
 public:
@@ -42,17 +49,85 @@ public:
 
     /**
      * @brief Use the decision function to make a best guess recognition.
+     *
+     * With an index the label is the most frequent one among the neighbors()
+     * nearest embeddings within max_distance(), ties going to the label of
+     * the nearest embedding, and the probability is its share of these
+     * embeddings. If no embedding is close enough the result is (UNKNOWN, 0).
+     *
      * @param  face Face representation use for recognition
      * @return      Name of the person recognized
      */
     std::pair<std::string, float> recognize(FaceNetEmbed face);
 
+    /**
+     * @brief Recognizes a set of faces, with the SVM in one matrix product.
+     *
+     * @param faces Face representations used for recognition
+     * @return      Name and probability of the person for every face
+     */
+    std::vector<std::pair<std::string, float> > recognize(const std::vector<FaceNetEmbed>& faces);
+
+    /**
+     * @brief Label of faces that are not close to any known face.
+     */
+    static const std::string UNKNOWN;
+
+    /**
+     * @brief Switches to nearest neighbour recognition using #index.
+     *
+     * train() and add() add to the index afterwards. An index that already
+     * holds embeddings, e.g. a loaded HNSWIndex, needs the labels of all of
+     * them. Passing a nullptr switches back to the SVM.
+     *
+     * @param index Index to store the embeddings in
+     * @param labels Labels of the embeddings in #index by id
+     */
+    void set_index(std::shared_ptr<EmbeddingIndex> index,
+                   const std::vector<std::string>& labels = std::vector<std::string>());
+
+    /**
+     * @brief Returns the labels of the embeddings in the index by id.
+     */
+    const std::vector<std::string>& labels() const {return labels_;}
+
+    /**
+     * @brief Adds a labeled face to the index without retraining.
+     *
+     * @param face  Face representation of the person
+     * @param label Name of the person
+     */
+    void add(const FaceNetEmbed& face, const std::string& label);
+
+    /**
+     * @brief Sets the number of neighbours that vote for a label.
+     */
+    void set_neighbors(size_t k);
+
+    /**
+     * @brief Returns the number of neighbours that vote for a label.
+     */
+    size_t neighbors() const {return neighbors_;}
+
+    /**
+     * @brief Sets the largest squared distance of a neighbour that may vote.
+     *
+     * The default of 0.99 is the threshold at which OpenFace separates
+     * pairs of the same person from different people on LFW.
+     */
+    void set_max_distance(float distance);
+
+    /**
+     * @brief Returns the largest squared distance of a neighbour that may vote.
+     */
+    float max_distance() const {return max_distance_;}
+
     /**
      * @brief Returns the decision function itself.
      * TODO(Jan): Only used temporarily to serialize df in the webcam example.
      * 			  This should be implemented as a save function.
      */
-    dlib::one_vs_all_decision_function<ova_trainer, dlib::probabilistic_function< dlib::decision_function<linear_kernel> > > df() {return df_;}
+    ova_decision_function df() {return df_;}
 
     /**
      * @brief Loads a serialized decision function from file.
@@ -75,7 +150,25 @@ private:
     /**
      * @brief Internal decision function.
      */
-    dlib::one_vs_all_decision_function<ova_trainer, dlib::probabilistic_function< dlib::decision_function<linear_kernel> > > df_;
+    ova_decision_function df_;
+
+    /**
+     * @brief #df_ compiled into one weight matrix.
+     */
+    LinearScorer scorer_;
+
+    /**
+     * @brief Nearest neighbour index, the SVM is used if it is null.
+     */
+    std::shared_ptr<EmbeddingIndex> index_;
+
+    /**
+     * @brief Labels of the embeddings in #index_ by id.
+     */
+    std::vector<std::string> labels_;
+
+    size_t neighbors_;
+    float max_distance_;
 };
 
 #endif
@@ -0,0 +1,153 @@
+#ifndef IDENTITYTRACKER_HPP
+#define IDENTITYTRACKER_HPP
+
+#include "facerecognizer.hpp"
+#include "../openface/openface.hpp"
+#include "../detection/videosession.hpp"
+
+#include <map>
+
+/**
+ * @brief Recognition result of a tracked face.
+ */
+struct Identity {
+    /**
+     * @brief Id of the Track the identity belongs to.
+     */
+    int id;
+
+    /**
+     * @brief Position of the face in the current frame.
+     */
+    Detection detection;
+
+    /**
+     * @brief Label with the highest fused probability.
+     */
+    std::string label;
+
+    /**
+     * @brief Fused probability of #label.
+     */
+    float probability;
+
+    /**
+     * @brief True if the face was embedded in the current frame.
+     */
+    bool embedded;
+};
+
+/**
+ * @brief Caches recognition results per track instead of recognizing every frame.
+ *
+ * Takes the tracks of a VideoSession and recognizes each face only when it
+ * is new, every reembed_interval() frames, or when its crop changed more
+ * than max_change() since it was last embedded, e.g. because the person
+ * turned the head. All faces that need an embedding in a frame are embedded
+ * in one batch.
+ *
+ * The predictions of a track are fused with an exponential moving average,
+ * each new prediction adds its probability to its label with weight
+ * 1 - decay(), so a single wrong prediction does not flip the label.
+ */
+class IdentityTracker {
+public:
+    /**
+     * @brief Constructs a tracker embedding with #of and recognizing with #fr.
+     *
+     * @param of OpenFace used to embed the faces, must outlive the tracker
+     * @param fr Trained recognizer, must outlive the tracker
+     * @param reembed_interval Number of frames after which a face is embedded again
+     * @param max_change Change of the face crop that triggers a new embedding
+     * @param decay Weight of the previous predictions when fusing
+     */
+    IdentityTracker(OpenFace& of, FaceRecognizer& fr, int reembed_interval = 15,
+                    double max_change = 0.1, double decay = 0.7);
+
+    /**
+     * @brief Default destructor.
+     */
+    ~IdentityTracker() {}
+
+    /**
+     * @brief Updates the identities with the tracks of the next frame.
+     *
+     * Identities of tracks that are not part of #tracks anymore are forgotten.
+     *
+     * @param  tracks Tracks of the current frame, see VideoSession::process()
+     * @return        Identity of each track, in the order of #tracks
+     */
+    std::vector<Identity> update(const std::vector<Track>& tracks);
+
+    /**
+     * @brief Sets the number of frames after which a face is embedded again.
+     * @param interval Number of frames, 1 embeds every frame
+     */
+    void set_reembed_interval(int interval);
+
+    /**
+     * @brief Returns the number of frames after which a face is embedded again.
+     */
+    int reembed_interval() const {return reembed_interval_;}
+
+    /**
+     * @brief Sets the change of the face crop that triggers a new embedding.
+     *
+     * The change is the mean absolute difference of small grayscale
+     * thumbnails of the crops, relative to the full intensity range.
+     *
+     * @param change Change in [0, 1]
+     */
+    void set_max_change(double change) {max_change_ = change;}
+
+    /**
+     * @brief Returns the change of the face crop that triggers a new embedding.
+     */
+    double max_change() const {return max_change_;}
+
+    /**
+     * @brief Returns the weight of the previous predictions when fusing.
+     */
+    double decay() const {return decay_;}
+
+    /**
+     * @brief Returns the number of faces embedded since construction.
+     */
+    size_t embeddings() const {return embeddings_;}
+
+    /**
+     * @brief Side length of the thumbnails used to detect changes of a face.
+     */
+    static const int THUMBNAIL_SIZE = 16;
+
+private:
+    /**
+     * @brief Cached recognition of a track.
+     */
+    struct State {
+        std::map<std::string, float> scores;
+        cv::Mat thumbnail;
+        int frames_since_embedding;
+        int predictions;
+    };
+
+    /**
+     * @brief Returns a small grayscale copy of the face in #d.
+     */
+    static cv::Mat thumbnail(const Detection& d);
+
+    /**
+     * @brief Adds a prediction to the fused scores of #s.
+     */
+    void fuse(State& s, const std::pair<std::string, float>& prediction);
+
+    OpenFace& of_;
+    FaceRecognizer& fr_;
+    std::map<int, State> states_;
+    int reembed_interval_;
+    double max_change_;
+    double decay_;
+    size_t embeddings_;
+};
+
+#endif
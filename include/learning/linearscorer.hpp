@@ -0,0 +1,111 @@
+#ifndef LINEARSCORER_HPP
+#define LINEARSCORER_HPP
+
+#include "../openface/neuralnetwork.hpp"
+
+#include <dlib/svm.h>
+#include <dlib/svm/one_vs_all_trainer.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef dlib::linear_kernel<FaceNetEmbed> linear_kernel;
+typedef dlib::one_vs_all_trainer<dlib::any_trainer<FaceNetEmbed, float>, std::string> ova_trainer;
+typedef dlib::probabilistic_function<dlib::decision_function<linear_kernel> > linear_probabilistic_function;
+typedef dlib::one_vs_all_decision_function<ova_trainer, linear_probabilistic_function> ova_decision_function;
+
+/**
+ * @brief Compiled form of a one vs all linear SVM with probabilistic outputs.
+ *
+ * With a linear kernel the support vectors of every class add up to a single
+ * weight vector w, so the probability of a class is
+ * 1 / (1 + exp(alpha * (w * x - b) + beta)). All weight vectors are packed
+ * into one contiguous classes() x 128 matrix, so an embedding is scored with
+ * one pass over it and a batch with one matrix product, which dlib hands to
+ * BLAS if it was built with it.
+ *
+ * The predictions are those of the decision function, up to the rounding of
+ * the weights, with ties going to the first label like in dlib.
+ */
+class LinearScorer {
+public:
+    /**
+     * @brief Creates a scorer without classes.
+     */
+    LinearScorer() {}
+
+    /**
+     * @brief Compiles a trained decision function.
+     *
+     * @param df Decision function with one probabilistic linear classifier per label
+     * @throw std::runtime_error if a classifier has no linear kernel
+     */
+    LinearScorer(const ova_decision_function& df);
+
+    /**
+     * @brief Returns the number of classes.
+     */
+    size_t classes() const {return labels_.size();}
+
+    /**
+     * @brief Returns the labels of the classes in the order of the weights.
+     */
+    const std::vector<std::string>& labels() const {return labels_;}
+
+    /**
+     * @brief Returns the weight vector of a class.
+     */
+    const float* weights(size_t c) const {return &W_(c, 0);}
+
+    /**
+     * @brief Finds the most probable class without allocating memory.
+     *
+     * @param face Embedding to score
+     * @return Index of the class in labels() and its probability
+     * @throw std::runtime_error if there are no classes
+     */
+    std::pair<size_t, float> classify(const FaceNetEmbed& face) const;
+
+    /**
+     * @brief Finds the most probable classes of a batch with one matrix product.
+     *
+     * @param faces Embeddings to score
+     * @return Index of the class in labels() and its probability for every face
+     * @throw std::runtime_error if there are no classes
+     */
+    std::vector<std::pair<size_t, float> > classify(const std::vector<FaceNetEmbed>& faces) const;
+
+    /**
+     * @brief Returns the most probable label and its probability, like
+     *        one_vs_all_decision_function::predict().
+     */
+    std::pair<std::string, float> predict(const FaceNetEmbed& face) const;
+
+    /**
+     * @brief Returns the most probable label and its probability for every face.
+     */
+    std::vector<std::pair<std::string, float> > predict(const std::vector<FaceNetEmbed>& faces) const;
+
+private:
+    /**
+     * @brief Number of classes scored per call of dot_products().
+     */
+    static const size_t BLOCK = 64;
+
+    /**
+     * @brief Weight vectors, one row per class.
+     */
+    dlib::matrix<float> W_;
+
+    /**
+     * @brief Biases, alphas and betas of the classes.
+     */
+    std::vector<float> b_;
+    std::vector<float> alpha_;
+    std::vector<float> beta_;
+
+    std::vector<std::string> labels_;
+};
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef PRODUCTQUANTIZER_HPP
+#define PRODUCTQUANTIZER_HPP
+
+#include "embeddingindex.hpp"
+#include "../database/facedatabase.hpp"
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief Compresses FaceNet embeddings to one byte per subspace.
+ *
+ * The 128 floats of an embedding are split into subspaces() groups of equal
+ * size, and each group is replaced by the index of the closest of 256
+ * centroids learned with k-means. With 16 or 32 subspaces an embedding takes
+ * 16 or 32 bytes instead of 512.
+ *
+ * Distances to a query are computed asymmetrically: distance_table() holds
+ * the distance of each subspace of the uncompressed query to every centroid,
+ * so the distance to a code is the sum of one table entry per subspace.
+ */
+class ProductQuantizer {
+public:
+    /**
+     * @brief Number of centroids per subspace, so a code entry is one byte.
+     */
+    static const size_t CENTROIDS = 256;
+
+    /**
+     * @brief Creates an untrained quantizer.
+     *
+     * @param subspaces Number of subspaces and bytes per code, has to divide 128
+     */
+    ProductQuantizer(size_t subspaces = 16);
+
+    /**
+     * @brief Learns the centroids of every subspace with k-means.
+     *
+     * @param samples Embeddings to learn from, at least CENTROIDS
+     * @param iterations Number of k-means iterations
+     * @param seed Seed of the initial centroids
+     */
+    void train(const std::vector<FaceNetEmbed>& samples, int iterations = 25, unsigned long seed = 0);
+
+    /**
+     * @brief Learns the centroids from the embeddings of a loaded database.
+     *
+     * @param db Database of embeddings
+     * @param max_samples Largest number of embeddings used, taken in order
+     * @param iterations Number of k-means iterations
+     */
+    void train(FaceNetEmbedDatabase& db, size_t max_samples = 100000, int iterations = 25);
+
+    /**
+     * @brief Returns true if the centroids have been learned or loaded.
+     */
+    bool trained() const {return !centroids_.empty();}
+
+    /**
+     * @brief Returns the number of subspaces, i.e. the bytes per code.
+     */
+    size_t subspaces() const {return subspaces_;}
+
+    /**
+     * @brief Writes the code of #embedding to subspaces() bytes at #code.
+     */
+    void encode(const FaceNetEmbed& embedding, uint8_t* code) const;
+
+    /**
+     * @brief Returns the embedding approximated by a code.
+     */
+    FaceNetEmbed decode(const uint8_t* code) const;
+
+    /**
+     * @brief Computes the distances of #query to all centroids.
+     *
+     * @param query Embedding to compare codes to
+     * @param table Destination of subspaces() * CENTROIDS squared distances
+     */
+    void distance_table(const FaceNetEmbed& query, float* table) const;
+
+    /**
+     * @brief Returns the squared distance of the query of #table to a code.
+     */
+    float distance(const float* table, const uint8_t* code) const {
+        float d = 0;
+        for (size_t j = 0; j < subspaces_; j++)
+            d += table[j * CENTROIDS + code[j]];
+        return d;
+    }
+
+    /**
+     * @brief Writes the centroids to a file.
+     *
+     * @throw std::runtime_error "Directory does not exist: ${path}"
+     */
+    void save(const std::string& path) const;
+
+    /**
+     * @brief Writes the centroids to a stream, e.g. inside another file.
+     * @return False if writing failed
+     */
+    bool save(std::ostream& out) const;
+
+    /**
+     * @brief Reads centroids written by save().
+     *
+     * @throw std::runtime_error if the file does not exist or is no quantizer
+     */
+    void load(const std::string& path);
+
+    /**
+     * @brief Reads centroids written by save(std::ostream&).
+     * @return False if the stream holds no quantizer, which leaves this one unchanged
+     */
+    bool load(std::istream& in);
+
+private:
+    size_t subspaces_;
+
+    /**
+     * @brief Floats per subspace.
+     */
+    size_t dims_;
+
+    /**
+     * @brief Centroids of subspace j at j * CENTROIDS * dims_, one after another.
+     */
+    std::vector<float> centroids_;
+};
+
+/**
+ * @brief Nearest neighbour search over product quantized embeddings.
+ *
+ * Only the codes are kept in memory, subspaces() bytes per embedding. A
+ * search computes the distance table of the query once and scans all codes
+ * with table lookups, sharded over threads() threads like BruteForceIndex.
+ *
+ * If a vector file is given, every added embedding is also appended to it
+ * in full. A search then takes rerank() times k candidates from the codes
+ * and orders them by their exact distance, read from the file.
+ *
+ * save() writes the quantizer and the codes. An index is reopened with the
+ * constructor taking the saved file and the vector file, which is appended
+ * to from then on.
+ */
+class PQIndex : public EmbeddingIndex {
+public:
+    /**
+     * @brief Creates an empty index.
+     *
+     * @param pq Trained quantizer
+     * @param vectors_path File the full embeddings are written to for the
+     *                     reranking, replaced if it exists, empty to keep
+     *                     only the codes
+     * @throw std::runtime_error if #pq is not trained or the file can not be created
+     */
+    PQIndex(const ProductQuantizer& pq, const std::string& vectors_path = "");
+
+    /**
+     * @brief Reopens an index written by save().
+     *
+     * @param index_path File written by save()
+     * @param vectors_path Vector file of the saved index, new embeddings are
+     *                     appended to it, empty to keep only the codes
+     * @throw std::runtime_error if a file does not exist, is no index or the
+     *        vector file holds another number of embeddings
+     */
+    PQIndex(const std::string& index_path, const std::string& vectors_path);
+
+    using EmbeddingIndex::add;
+    virtual void add(const FaceNetEmbed& embedding);
+
+    virtual size_t size() const {return codes_.size() / pq_.subspaces();}
+
+    virtual std::vector<Neighbor> search(const FaceNetEmbed& query, size_t k) const;
+
+    /**
+     * @brief Sets how many candidates per neighbour are reranked exactly.
+     *
+     * Only used with a vector file, 1 disables the reranking.
+     */
+    void set_rerank(size_t factor);
+
+    /**
+     * @brief Returns how many candidates per neighbour are reranked exactly.
+     */
+    size_t rerank() const {return rerank_;}
+
+    /**
+     * @brief Returns the bytes of memory used by the codes.
+     */
+    size_t code_bytes() const {return codes_.size();}
+
+    /**
+     * @brief Writes the quantizer and the codes to a file.
+     *
+     * The vector file is not copied, it stays valid next to the saved codes.
+     *
+     * @param path File to write
+     * @throw std::runtime_error "Directory does not exist: ${path}"
+     */
+    void save(const std::string& path) const;
+
+    /**
+     * @brief Replaces the quantizer and the codes with those written by save().
+     *
+     * @param path File to read
+     * @throw std::runtime_error if the file does not exist, is no index or
+     *        the open vector file holds another number of embeddings, in
+     *        which case the index is unchanged
+     */
+    void load(const std::string& path);
+
+    /**
+     * @brief Sets the number of threads used by search().
+     * @param threads Number of threads, 1 to search in the calling thread only
+     */
+    void set_threads(int threads);
+
+    /**
+     * @brief Returns the number of threads used by search().
+     */
+    int threads() const {return threads_;}
+
+private:
+    /**
+     * @brief Scans all codes and returns the #k nearest by approximate distance.
+     */
+    std::vector<Neighbor> scan(const FaceNetEmbed& query, size_t k) const;
+
+    /**
+     * @brief Opens the vector file, replacing it or appending to it.
+     */
+    void open_vectors(const std::string& path, bool replace);
+
+    /**
+     * @brief Returns the number of embeddings in the vector file.
+     */
+    size_t stored_vectors() const;
+
+    ProductQuantizer pq_;
+    std::vector<uint8_t> codes_;
+
+    std::string vectors_path_;
+    mutable std::ofstream writer_;
+    mutable std::ifstream reader_;
+
+    /**
+     * @brief Protects the vector file, written by add() and read by search().
+     */
+    mutable std::mutex reader_mutex_;
+
+    /**
+     * @brief True if embeddings were written since the last flush of #writer_.
+     */
+    mutable bool unflushed_;
+
+    size_t rerank_;
+    int threads_;
+};
+
+#endif
@@ -4,6 +4,8 @@
 #include "face.hpp"
 #include "detection/facedetector.hpp"
 
+#include <algorithm>
+#include <thread>
 #include <dlib/matrix.h>
 #include <dlib/image_processing.h>
 
@@ -16,6 +18,11 @@
  * This class uses dlib's shape predictor to find features in the face and align
  * the faces by calculating a transformation matrix.
  *
+ * Either the 68 point model FACE_SHAPE or the compact 5 point model
+ * FACE_SHAPE_5 can be loaded. The 5 point model has the outer eye corners and
+ * the bottom of the nose as well, so both align onto the same template, but
+ * it is a fraction of the size and predicts faster.
+ *
  * @see http://blog.dlib.net/2014/08/real-time-face-pose-estimation.html
  */
 class FaceAligner {
@@ -32,17 +39,51 @@ class FaceAligner {
      */
     dlib::full_object_detection predict(const Detection& d) const;
 
+    /**
+     * @brief Returns the transformation onto OUTER_EYES_AND_NOSE for a shape.
+     */
+    cv::Mat transformation(const dlib::full_object_detection& shape) const;
+
+    /**
+     * @brief Samples the face from #src into planar float memory.
+     *
+     * @param src Color frame the transformation refers to
+     * @param H Transformation from the frame onto the aligned face
+     * @param data Destination of 3*FACE_SIZE_CONSTRAINT^2 floats
+     */
+    void sample(const cv::Mat& src, const cv::Mat& H, float* data) const;
+
+    /**
+     * @brief Parts of the pose model at the outer eyes and the nose.
+     *
+     * Mapped onto OUTER_EYES_AND_NOSE, set by load() from the number of parts.
+     */
+    unsigned long landmarks_[3];
+
+    int threads_;
+
     bool initialized_;
 public:
     /**
      * Default constructor.
      */
-    FaceAligner() : initialized_(false) {}
+    FaceAligner() : threads_(std::max(1u, std::thread::hardware_concurrency())), initialized_(false) {}
 
     FaceAligner(const std::string& shape_path);
 
+    /**
+     * @brief Loads a 68 or 5 point shape predictor.
+     *
+     * @param shape_path Path to a serialized dlib::shape_predictor
+     * @throw std::runtime_error if the model has neither 68 nor 5 parts
+     */
     void load(const std::string& shape_path);
 
+    /**
+     * @brief Returns the number of landmarks the pose model predicts, 68 or 5.
+     */
+    unsigned long num_parts() const {return pose_model.num_parts();}
+
     /**
      * Default destructor.
      */
@@ -61,10 +102,98 @@ public:
     void align(Detection& d) const;
 
     /**
-     * @brief Calls align() on a set of faces.
+     * @brief Sets the number of threads used to align a set of faces.
+     *
+     * Defaults to the number of cores. Callers that align from several
+     * threads at once, e.g. one per network of a NeuralNetworkPool, already
+     * use every core and should set 1 to avoid oversubscription.
+     *
+     * @param threads Number of threads, 1 to align in the calling thread only
+     */
+    void set_threads(int threads);
+
+    /**
+     * @brief Returns the number of threads used to align a set of faces.
+     */
+    int threads() const {return threads_;}
+
+    /**
+     * @brief Calls align() on a set of faces, on up to threads() threads.
+     *
+     * The shape predictor is only read, so all threads share it. Every face
+     * is aligned into its own detection, so the order is kept.
+     *
      * @param faces Faces to be aligned.
      */
     void align(std::vector<Detection>& ds) const;
+
+    /**
+     * @brief Calls align(const Detection&, float*) on a set of faces in parallel.
+     *
+     * @param ds Detections of the faces to be aligned
+     * @param data Destination of ds.size() faces of 3*FACE_SIZE_CONSTRAINT^2
+     *             floats each, e.g. a NeuralNetwork input tensor
+     */
+    void align(const std::vector<Detection>& ds, float* data) const;
+
+    /**
+     * @brief Calls align(const Detection&, float*) on #n faces in parallel.
+     *
+     * Takes part of a larger set of detections without copying it, e.g. one
+     * batch of the network.
+     *
+     * @param ds First of the detections of the faces to be aligned
+     * @param n Number of detections
+     * @param data Destination of #n faces of 3*FACE_SIZE_CONSTRAINT^2 floats each
+     */
+    void align(const Detection* ds, size_t n, float* data) const;
+
+    /**
+     * @brief Aligns a face straight into planar float memory.
+     *
+     * Computes the same affine transformation as align(Detection&) but instead
+     * of warping into an intermediate 8-bit Image, samples the detection's
+     * source image bilinearly and writes the RGB planes scaled to [0, 1] as
+     * expected by the NeuralNetwork. The detection itself is not modified.
+     *
+     * @param d Detection of the face to be aligned
+     * @param data Destination of 3*FACE_SIZE_CONSTRAINT^2 floats, e.g. one
+     *             face of a NeuralNetwork input tensor
+     */
+    void align(const Detection& d, float* data) const;
+
+    /**
+     * @brief Returns the 2x3 transformation that maps the detected face onto
+     *        the OUTER_EYES_AND_NOSE template.
+     *
+     * @param d Detection of the face to be aligned
+     * @return  Affine transformation as CV_64F matrix
+     */
+    cv::Mat transformation(const Detection& d) const;
+
+    /**
+     * @brief Returns the transformation of a face detected on #img.
+     *
+     * Predicts the landmarks on the grayscale frame of #img, so the frame is
+     * not converted again for every face.
+     *
+     * @param img Prepared frame the face was detected on
+     * @param d Detection of the face to be aligned, d.face is not used
+     * @return  Affine transformation as CV_64F matrix
+     */
+    cv::Mat transformation(const PreparedImage& img, const Detection& d) const;
+
+    /**
+     * @brief Aligns a face detected on #img straight into planar float memory.
+     *
+     * Like align(const Detection&, float*) but the landmarks are predicted on
+     * the grayscale frame of #img and the pixels are sampled from img.image().
+     *
+     * @param img Prepared frame the face was detected on
+     * @param d Detection of the face to be aligned
+     * @param data Destination of 3*FACE_SIZE_CONSTRAINT^2 floats
+     */
+    void align(const PreparedImage& img, const Detection& d, float* data) const;
 };
 
 #endif
@@ -0,0 +1,183 @@
+#ifndef NATIVENETWORK_HPP
+#define NATIVENETWORK_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Feature maps of a single image inside the NativeNetwork.
+ *
+ * Data is stored planar, that is channel by channel and row by row.
+ */
+struct Blob {
+    int c, h, w;
+    std::vector<float> data;
+
+    Blob() : c(0), h(0), w(0) {}
+    Blob(int channels, int height, int width) :
+        c(channels), h(height), w(width), data(channels*height*width, 0.f) {}
+
+    float* plane(int i) {return data.data() + i*h*w;}
+    const float* plane(int i) const {return data.data() + i*h*w;}
+};
+
+/**
+ * @brief Base class of the layers of a NativeNetwork.
+ */
+class NativeLayer {
+public:
+    virtual ~NativeLayer() {}
+
+    /**
+     * @brief Computes the output feature maps of the layer.
+     *
+     * @param in Input of the layer
+     * @param out Output of the layer, resized by the layer
+     */
+    virtual void forward(const Blob& in, Blob& out) const =0;
+
+    /**
+     * @brief Appends all layers without sublayers to #layers in forward order.
+     */
+    virtual void collect(std::vector<NativeLayer*>& layers) {layers.push_back(this);}
+};
+
+/**
+ * @brief Self-contained C++ implementation of the OpenFace network forward pass.
+ *
+ * Runs networks like nn4.v2 without the lua and torch runtime. The class
+ * only depends on the standard library and is built into the separate
+ * cpp_openface_native library, which can be linked without torch. The
+ * NeuralNetwork wrapper still takes torch tensors as input, so
+ * cpp_openface itself keeps linking TH and lua. The layers
+ * are read from a weight file that is created from the torch network with
+ * src/openface/convert_nn.lua. Supported are the layers used by the OpenFace
+ * models: convolutions (computed with im2col and a GEMM, batch normalization
+ * is folded into the preceding convolution when loading), max, average and
+ * LP pooling, cross map LRN, depth concatenation as used by the inception
+ * blocks, linear layers and L2 normalization.
+ *
+ * forward() is const and keeps all intermediate results on the stack of the
+ * calling thread, so one network can be used by many threads at once.
+ *
+ * The network can optionally run its convolutions and linear layers in int8.
+ * Weights are quantized symmetrically per output channel, activations per
+ * layer to unsigned 7 bit with a range that is calibrated on sample faces
+ * with calibrate(). Every layer input is quantized once and then unfolded,
+ * the products are computed with AVX2 or AVX-512 if the CPU supports it.
+ */
+class NativeNetwork {
+public:
+    /**
+     * @brief Default constructor, the network has to be loaded with load().
+     */
+    NativeNetwork();
+
+    /**
+     * @brief Constructs the network from a converted weight file.
+     *
+     * @param path Path to the file written by convert_nn.lua
+     */
+    NativeNetwork(const std::string& path);
+
+    /**
+     * @brief Default destructor.
+     */
+    ~NativeNetwork();
+
+    /**
+     * @brief Loads the network from a converted weight file.
+     *
+     * @param path Path to the file written by convert_nn.lua
+     * @throw std::runtime_error "No such file or directory: ${path}"
+     * @throw std::runtime_error "Not a converted network: ${path}" if the
+     *        file is corrupt or contains unsupported layers
+     */
+    void load(const std::string& path);
+
+    /**
+     * @brief Sets the number of threads used to forward the images of a batch.
+     * @param threads Number of threads
+     */
+    void set_num_threads(int threads) {threads_ = threads;}
+
+    /**
+     * @brief Forwards a batch of images through the network.
+     *
+     * @param  input  n planar 3 x height x width images stored one after another
+     * @param  n      Number of images
+     * @param  height Height of the images
+     * @param  width  Width of the images
+     * @return        Flattened network output for each image
+     */
+    std::vector<std::vector<float> > forward(const float* input, size_t n, int height, int width) const;
+
+    /**
+     * @brief Records the activation range of every layer on sample images.
+     *
+     * Runs the float network on the images and keeps the smallest and the
+     * largest input value of each convolution and linear layer. Can be called several
+     * times to accumulate more samples. Runs single threaded.
+     *
+     * @param input  n planar 3 x height x width images stored one after another
+     * @param n      Number of images
+     * @param height Height of the images
+     * @param width  Width of the images
+     */
+    void calibrate(const float* input, size_t n, int height, int width);
+
+    /**
+     * @brief Switches between float and int8 inference.
+     *
+     * Switching to int8 releases the float weights unless they are kept, so
+     * the quantized network needs about a quarter of the memory. Without
+     * them the network can neither be switched back nor calibrated again
+     * before it is reloaded.
+     *
+     * @param quantized True to run convolutions and linear layers in int8
+     * @param keep_float_weights True to keep the float weights, e.g. to compare both modes
+     * @throw std::runtime_error if the network has not been calibrated or
+     *        the float weights have been released
+     */
+    void set_quantized(bool quantized, bool keep_float_weights = false);
+
+    /**
+     * @brief Returns true if the network runs in int8.
+     */
+    bool quantized() const {return quantized_;}
+
+    /**
+     * @brief Returns the memory held by the float and int8 weights in bytes.
+     */
+    size_t weight_bytes() const;
+
+    /**
+     * @brief Writes the calibrated activation ranges to a file.
+     * @param path File to be written
+     */
+    void save_calibration(const std::string& path) const;
+
+    /**
+     * @brief Reads activation ranges written by save_calibration().
+     * @param path File to be read
+     * @throw std::runtime_error if the file does not belong to this network
+     */
+    void load_calibration(const std::string& path);
+
+private:
+    /**
+     * @brief Root of the layer tree, usually a sequence of layers.
+     */
+    std::unique_ptr<NativeLayer> root_;
+
+    /**
+     * @brief All leaf layers of #root_ in forward order.
+     */
+    std::vector<NativeLayer*> layers_;
+
+    int threads_;
+    bool quantized_;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define NEURALNETWORK_HPP
 
 #include "torchinterface.hpp"
+#include "nativenetwork.hpp"
 #include "face.hpp"
 
 #include <iostream>
@@ -18,8 +19,9 @@ typedef dlib::matrix<float, 128, 1> FaceNetEmbed;
  * The OpenFace project uses FaceNet embeddings, which are a 128-byte vector,
  * as representations for faces. Theses are created by forwarding a 96x96 px
  * image of a face to a neural network. This process is what this class provides.
- * The actual forwarding happens in a torch script which made available by the
- * TorchInterface.
+ * The actual forwarding happens either in a torch script which made available
+ * by the TorchInterface, or in the NativeNetwork C++ implementation when the
+ * network is loaded from a converted weight file.
  */
 class NeuralNetwork {
 public:
@@ -29,10 +31,18 @@ public:
      * This constructor automatically loads the torch script at the path
      * FORWARD_DEFINITION which is defined in openface/settings.hpp.
      */
-    NeuralNetwork() : initialized_(false) {};
+    NeuralNetwork() : inputs_(FACE_SIZE_CONSTRAINT, FACE_SIZE_CONSTRAINT),
+        forward_ref_(LUA_NOREF), batch_size_(MAX_BATCH_SIZE), initialized_(false) {};
 
     NeuralNetwork(const std::string script_path, const std::string nn_path);
 
+    /**
+     * @brief Constructs a network that runs on the NativeNetwork backend.
+     *
+     * @param weights_path Path to the network converted with convert_nn.lua
+     */
+    NeuralNetwork(const std::string weights_path);
+
     /**
      * @brief Default destructor.
      */
@@ -41,8 +51,8 @@ public:
     /**
      * @brief Converts a face image to a FaceNet embedding.
      *
-     * Calls the function "forward_nn" inside the loaded torch script with a
-     * torch.FloatTensor containing the face's raw image data as only parameter.
+     * Copies the face's raw image data into a 1x3x96x96 input tensor and
+     * forwards it with forward_nn(Tensor&).
      *
      * @param  face Face to be converted, must be *aligned*
      * @return      FaceNetEmbed (128-byte vector) representation of #face
@@ -54,15 +64,150 @@ public:
     void load(const std::string script_path, const std::string nn_path);
 
     /**
-     * @brief Calls forward_nn() on a set of faces.
+     * @brief Loads a converted network and uses the NativeNetwork backend.
+     *
+     * No torch script is run in this mode and the lua interpreter stays
+     * unused, but the inputs are still passed in torch tensors.
+     *
+     * @param weights_path Path to the network converted with convert_nn.lua
+     */
+    void load(const std::string weights_path);
+
+    /**
+     * @brief Returns true if the network runs on the NativeNetwork backend.
+     */
+    bool native() const {return (bool)native_;}
+
+    /**
+     * @brief Converts a set of face images to FaceNet embeddings in batches.
+     *
+     * Packs up to batch_size() faces into a single Nx3x96x96 tensor and calls
+     * the function "forward_nn_batch" inside the loaded torch script, so the
+     * network is only run once per batch instead of once per face.
+     *
+     * @param  imgs Faces to be converted, must be *aligned*
+     * @return      FaceNetEmbed representations in the same order as #imgs
      */
     std::vector<FaceNetEmbed> forward_nn(const std::vector<Image> &imgs) const;
+
+    /**
+     * @brief Returns an input tensor for #n faces.
+     *
+     * The returned Nx3x96x96 tensor can be filled in place, e.g. with
+     * FaceAligner::align(const Detection&, float*), and then be passed to
+     * forward_nn(Tensor&). Input tensors are recycled from a TensorPool, so
+     * steady-state forwarding does not allocate.
+     *
+     * @param  n Number of faces, at most batch_size()
+     * @return   Uninitialized input tensor
+     */
+    Tensor input(size_t n) const;
+
+    /**
+     * @brief Forwards a filled input tensor through the network.
+     *
+     * The tensor is handed to lua by reference and forwarded without copying.
+     *
+     * @param  input Tensor of Nx3x96x96 aligned faces, see input()
+     * @return       FaceNetEmbed representations of the N faces
+     */
+    std::vector<FaceNetEmbed> forward_nn(Tensor& input) const;
+
+    /**
+     * @brief Sets the maximum number of faces forwarded in one batch.
+     * @param size Maximum batch size, must be positive
+     */
+    void set_batch_size(int size);
+
+    /**
+     * @brief Returns the maximum number of faces forwarded in one batch.
+     */
+    int batch_size() const {return batch_size_;}
+
+    /**
+     * @brief Sets the number of threads torch uses inside a single forward.
+     *
+     * When several networks run concurrently, e.g. in a NeuralNetworkPool,
+     * each of them should use a single thread to avoid oversubscription.
+     * The NativeNetwork backend uses the threads for the faces of a batch.
+     *
+     * @param threads Number of torch threads
+     */
+    void set_num_threads(int threads);
+
+    /**
+     * @brief Calibrates the int8 mode of the NativeNetwork backend on sample faces.
+     *
+     * @param faces Aligned faces representative of the faces to be embedded
+     * @throw std::runtime_error if the network is not native
+     *
+     * @see NativeNetwork::calibrate()
+     */
+    void calibrate(const std::vector<Image>& faces);
+
+    /**
+     * @brief Switches the NativeNetwork backend between float and int8.
+     *
+     * @param quantized True to compute the embeddings in int8
+     * @param keep_float_weights True to keep the float weights to switch back later
+     * @throw std::runtime_error if the network is not native or not calibrated
+     *
+     * @see NativeNetwork::set_quantized()
+     */
+    void set_quantized(bool quantized, bool keep_float_weights = false);
+
+    /**
+     * @brief Loads a calibration written by save_calibration() and switches to int8.
+     *
+     * @param calibration_path Path to the calibration file
+     * @throw std::runtime_error if the network is not native
+     */
+    void quantize(const std::string& calibration_path);
+
+    /**
+     * @brief Writes the calibration of the int8 mode to a file.
+     * @param calibration_path File to be written
+     */
+    void save_calibration(const std::string& calibration_path) const;
+
+    /**
+     * @brief Returns the memory held by the weights of the native backend in bytes.
+     */
+    size_t weight_bytes() const {return native_network().weight_bytes();}
 private:
+    /**
+     * @brief Returns the native backend or throws if the network runs in torch.
+     */
+    NativeNetwork& native_network() const;
+
 
     /**
      * @brief Provides interface to torch code.
      */
-    TorchInterface torch;
+    mutable TorchInterface torch;
+
+    /**
+     * @brief Recycled input tensors of the network.
+     */
+    mutable TensorPool inputs_;
+
+    /**
+     * @brief Registry reference to the script's forward_nn_batch function.
+     *
+     * The function is pinned in the lua registry when the script is loaded,
+     * so forwarding does not have to look up the global by name.
+     */
+    int forward_ref_;
+
+    /**
+     * @brief C++ implementation of the network, set if loaded from a converted file.
+     */
+    std::unique_ptr<NativeNetwork> native_;
+
+    /**
+     * @brief Maximum number of faces in one forward pass.
+     */
+    int batch_size_;
 
     bool initialized_;
 };
@@ -0,0 +1,127 @@
+#ifndef NEURALNETWORKPOOL_HPP
+#define NEURALNETWORKPOOL_HPP
+
+#include "neuralnetwork.hpp"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Pool of independently loaded neural networks for concurrent embedding.
+ *
+ * A NeuralNetwork owns a single lua::State which is not re-entrant, so it can
+ * only run one forward at a time. This class loads the same torch script and
+ * network file into several NeuralNetwork instances and hands them out to
+ * calling threads. Checking out and returning a network is lock-free: each
+ * network has an atomic busy flag that is claimed by compare-and-swap, and a
+ * thread only yields when all networks are in use.
+ *
+ * All forward_nn() functions are thread-safe. Threads that also align their
+ * faces should use a FaceAligner restricted to one thread, see
+ * FaceAligner::set_threads().
+ */
+class NeuralNetworkPool {
+public:
+    /**
+     * @brief Default constructor, the pool has to be loaded with load().
+     */
+    NeuralNetworkPool() : next_(0), initialized_(false) {}
+
+    /**
+     * @brief Constructs and loads a pool of #size networks.
+     *
+     * @param script_path Path to the torch script defining forward_nn
+     * @param nn_path Path to the serialized torch network
+     * @param size Number of interpreter states, defaults to the number of cores
+     */
+    NeuralNetworkPool(const std::string script_path, const std::string nn_path, int size = 0);
+
+    /**
+     * @brief Default destructor.
+     */
+    ~NeuralNetworkPool() {}
+
+    /**
+     * @brief Loads #size interpreter states with the same script and network.
+     *
+     * Each network is restricted to a single torch thread, parallelism comes
+     * from running the networks concurrently.
+     *
+     * @param script_path Path to the torch script defining forward_nn
+     * @param nn_path Path to the serialized torch network
+     * @param size Number of interpreter states, defaults to the number of cores
+     */
+    void load(const std::string script_path, const std::string nn_path, int size = 0);
+
+    /**
+     * @brief Returns the number of interpreter states in the pool.
+     */
+    int size() const {return networks_.size();}
+
+    /**
+     * @brief Sets the maximum batch size of every network in the pool.
+     * @see NeuralNetwork::set_batch_size()
+     */
+    void set_batch_size(int size);
+
+    /**
+     * @brief Converts a face image to a FaceNet embedding on a free network.
+     *
+     * Blocks (yielding) until one of the networks is available.
+     *
+     * @param  img Face to be converted, must be *aligned*
+     * @return     FaceNetEmbed representation of #img
+     */
+    FaceNetEmbed forward_nn(const Image& img) const;
+
+    /**
+     * @brief Converts a set of faces, spreading the batches over all networks.
+     *
+     * @param  imgs Faces to be converted, must be *aligned*
+     * @return      FaceNetEmbed representations in the same order as #imgs
+     */
+    std::vector<FaceNetEmbed> forward_nn(const std::vector<Image>& imgs) const;
+
+private:
+    /**
+     * @brief Claims a free network and returns its index.
+     */
+    size_t checkout() const;
+
+    /**
+     * @brief Releases a network claimed by checkout().
+     */
+    void checkin(size_t i) const;
+
+    /**
+     * @brief Returns a checked out network to the pool when leaving scope.
+     */
+    struct Lease {
+        const NeuralNetworkPool& pool;
+        size_t index;
+
+        Lease(const NeuralNetworkPool& p) : pool(p), index(p.checkout()) {}
+        ~Lease() {pool.checkin(index);}
+        const NeuralNetwork& nn() const {return *pool.networks_[index];}
+    };
+
+    /**
+     * @brief Independently loaded networks, each with its own interpreter.
+     */
+    std::vector<std::unique_ptr<NeuralNetwork> > networks_;
+
+    /**
+     * @brief One busy flag per network, true while checked out.
+     */
+    std::unique_ptr<std::atomic<bool>[]> busy_;
+
+    /**
+     * @brief Index at which the next checkout starts looking.
+     */
+    mutable std::atomic<size_t> next_;
+
+    bool initialized_;
+};
+
+#endif
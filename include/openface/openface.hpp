@@ -62,15 +62,22 @@ public:
 
     /**
      * @brief Get a FaceNet representation of the unaligned face
-     * @param  face Aligned or unaligned Face to be forwarded to neural network
-     * @return      FaceNet embedding of the given face.
+     *
+     * The face is aligned directly into the input tensor of the neural network,
+     * without creating an intermediate aligned Image, so #d is left untouched.
+     *
+     * @param  d Detection of the face to be forwarded to neural network
+     * @return   FaceNet embedding of the given face.
      */
-    FaceNetEmbed facenet(Detection& d);
+    FaceNetEmbed facenet(const Detection& d);
 
     /**
-     * @brief Calls facenet() on a set of faces.
+     * @brief Calls facenet() on a set of faces, forwarding them in batches.
+     *
+     * Used with FaceDetector::detect_all() all faces of a frame are embedded
+     * in one forward pass, as long as they fit into NeuralNetwork::batch_size().
      */
-    std::vector<FaceNetEmbed> facenet(std::vector<Detection>&);
+    std::vector<FaceNetEmbed> facenet(const std::vector<Detection>&);
 };
 
 #endif
@@ -0,0 +1,54 @@
+#ifndef PIXELCONVERSION_HPP
+#define PIXELCONVERSION_HPP
+
+#include <cstddef>
+
+/**
+ * @brief Converts interleaved BGR bytes to planar RGB floats scaled to [0, 1].
+ *
+ * This is the conversion done for every face before it is forwarded to the
+ * neural network. The fastest kernel supported by the CPU is selected at
+ * runtime (AVX2, SSE4.1 or the scalar loop). All kernels compute value / 255
+ * in single precision, which is bit-exact with the double precision
+ * 1./255 * value of the original implementation.
+ *
+ * @param bgr Pointer to 3*n bytes of interleaved BGR pixel data
+ * @param n Number of pixels
+ * @param r Destination of the n red values
+ * @param g Destination of the n green values
+ * @param b Destination of the n blue values
+ */
+void bgr_to_planar_rgb(const unsigned char* bgr, size_t n, float* r, float* g, float* b);
+
+/**
+ * @brief Scalar reference implementation of bgr_to_planar_rgb().
+ */
+void bgr_to_planar_rgb_scalar(const unsigned char* bgr, size_t n, float* r, float* g, float* b);
+
+/**
+ * @brief SSE4.1 implementation of bgr_to_planar_rgb().
+ *
+ * Must only be called if bgr_to_planar_rgb_supported("sse4.1") is true.
+ */
+void bgr_to_planar_rgb_sse(const unsigned char* bgr, size_t n, float* r, float* g, float* b);
+
+/**
+ * @brief AVX2 implementation of bgr_to_planar_rgb().
+ *
+ * Must only be called if bgr_to_planar_rgb_supported("avx2") is true.
+ */
+void bgr_to_planar_rgb_avx2(const unsigned char* bgr, size_t n, float* r, float* g, float* b);
+
+/**
+ * @brief Returns true if the kernel for the given instruction set can run here.
+ *
+ * @param isa One of "scalar", "sse4.1" or "avx2"
+ */
+bool bgr_to_planar_rgb_supported(const char* isa);
+
+/**
+ * @brief Returns the name of the instruction set used by bgr_to_planar_rgb().
+ */
+const char* bgr_to_planar_rgb_isa();
+
+#endif
@@ -3,8 +3,13 @@
 
 #define FACE_SIZE_CONSTRAINT 96
 #define NEURAL_NETWORK "resources/nn4.v2.t7"
+#define NATIVE_NEURAL_NETWORK "resources/nn4.v2.ofnn"
 #define FACE_SHAPE "resources/shape_predictor_68_face_landmarks.dat"
+#define FACE_SHAPE_5 "resources/shape_predictor_5_face_landmarks.dat"
 #define FORWARD_DEFINITION "src/openface/forward_nn.lua"
+#define MAX_BATCH_SIZE 32
+#define TENSOR_POOL_SIZE 4
+#define DETECTOR_WINDOW_SIZE 80
 
 static const cv::Point2f MINMAX_TEMPLATE[] = {
     cv::Point2f( 0.          ,0.17856914),
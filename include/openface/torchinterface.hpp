@@ -2,12 +2,19 @@
 #define TORCHINTERFACE_HPP
 
 #include "../core/image.hpp"
+#include "pixelconversion.hpp"
+#include "settings.hpp"
 
 #include <LuaState.h>
 #include <LuaStack.h>
 #include <TH/TH.h>
 #include <luaT.h>
 
+#include <vector>
+#include <cassert>
+#include <stdexcept>
+#include <functional>
+
 typedef THFloatTensor FloatTensor;
 typedef THFloatStorage FloatStorage;
 
@@ -23,14 +30,20 @@ typedef lua::State TorchInterface;
 #define FloatTensor_(x) THFloatTensor_##x
 #define FloatStorage_(x) THFloatStorage_##x
 #define TensorData FloatTensor_(data) // float* to data of the Tensor
+#define TensorNew4d FloatTensor_(newWithSize4d)
 #define TensorNew3d FloatTensor_(newWithSize3d)
 #define TensorNew1d FloatTensor_(newWithSize1d)
 #define TensorFree FloatTensor_(free)
+#define TensorRetain FloatTensor_(retain)
+#define TensorResize4d FloatTensor_(resize4d)
 
 /**
  * @brief Wrapper for torch Tensor type.
  *
- * Uses THFloatTensors to store data which can be send to torch scripts.
+ * Uses THFloatTensors to store data which can be send to torch scripts. The
+ * wrapper owns one reference to the THFloatTensor: copies retain the tensor,
+ * the destructor releases it, and the tensor is freed once neither C++ nor
+ * lua hold a reference anymore.
  */
 class Tensor {
 public:
@@ -41,16 +54,71 @@ public:
      */
     Tensor (const Image& image);
 
+    /**
+     * @brief Constructs a batched torch Tensor from a range of images.
+     *
+     * Packs the images in [begin, end) into a single Nx3xHxW tensor, where all
+     * images are required to have the same size as the first one.
+     *
+     * @param images Images of which the data will be copied into the tensor
+     * @param begin Index of the first image of the batch
+     * @param end Index one past the last image of the batch
+     */
+    Tensor (const std::vector<Image>& images, size_t begin, size_t end);
+
+    /**
+     * @brief Constructs an uninitialized Nx3xHxW tensor.
+     *
+     * Used to write image data directly into the tensor, e.g. by
+     * FaceAligner::align(const Detection&, float*).
+     *
+     * @param n Number of images
+     * @param height Height of each image
+     * @param width Width of each image
+     */
+    Tensor (size_t n, int height, int width);
+
     /**
      * @brief Constructs tensor from an existing Tensor
+     *
+     * Takes over the reference of #tensor, so it must be a newly created
+     * tensor or have been retained for this wrapper.
      */
     Tensor (FloatTensor* tensor);
 
     /**
-     * @brief Default destructor.
+     * @brief Copies the wrapper, both wrappers refer to the same data.
+     */
+    Tensor (const Tensor& other);
+
+    /**
+     * @brief Releases the current tensor and refers to the data of #other.
+     */
+    Tensor& operator= (const Tensor& other);
+
+    /**
+     * @brief Releases the reference to the wrapped tensor.
      */
     ~Tensor ();
 
+    /**
+     * @brief Copies an image into the i-th image of an Nx3xHxW tensor.
+     *
+     * @param i Index of the image in the batch
+     * @param image Image of which the data will be copied, must be HxW
+     */
+    void copy(size_t i, const Image& image);
+
+    /**
+     * @brief Resizes an Nx3xHxW tensor to hold #n images.
+     *
+     * Only reallocates if the storage is too small, so shrinking and growing
+     * back does not touch the allocator.
+     *
+     * @param n Number of images
+     */
+    void resize(size_t n);
+
     //TODO: Implement function for size
     /**
      * @brief Returns the raw pointer to the wrapped Tensor.
@@ -64,6 +132,14 @@ private:
      * @brief Wrapped FloatTensor pointer.
      */
     FloatTensor* tensor_;
+
+    /**
+     * @brief Converts interleaved BGR pixels to planar RGB floats in [0, 1].
+     *
+     * @param data Destination of 3*w*h floats
+     * @param image Image of which the data will be copied
+     */
+    static void fill(float* data, const Image& image);
 };
 
 
@@ -74,34 +150,156 @@ private:
 namespace lua {
 
     namespace stack {
+        // The pushed userdata owns a reference which lua's gc releases.
         template<>
         inline int push(lua_State* luaState, Tensor value) {
+            TensorRetain(value.raw());
             luaT_pushudata(luaState, value.raw(), "torch.FloatTensor");
             return 1;
         }
 
+        // The returned tensor is still referenced from lua, retain it for the wrapper.
         template<>
         inline Tensor read(lua_State* luaState, int index) {
-            return Tensor((FloatTensor*)luaT_toudata(luaState, index, "torch.FloatTensor"));
+            FloatTensor* tensor = (FloatTensor*)luaT_toudata(luaState, index, "torch.FloatTensor");
+            if (tensor)
+                TensorRetain(tensor);
+            return Tensor(tensor);
         }
     }
 }
 
-inline Tensor::Tensor(const Image& img) {
+inline void Tensor::fill(float* data, const Image& img) {
     int w = img.width(), h = img.height();
 
-    tensor_ = TensorNew3d(3, h, w);
-    const Pixel* imgdata = img.pixeldata();
-    float* data = TensorData(tensor_);
-    for (int i = 0; i < w*h; ++i) {
-        data[i      ] = 1./255 * imgdata[i][2];
-        data[i+w*h  ] = 1./255 * imgdata[i][1];
-        data[i+2*w*h] = 1./255 * imgdata[i][0];
-     }
+    const unsigned char* imgdata = (const unsigned char*)img.pixeldata();
+    bgr_to_planar_rgb(imgdata, w*h, data, data + w*h, data + 2*w*h);
+}
+
+inline Tensor::Tensor(const Image& img) {
+    tensor_ = TensorNew3d(3, img.height(), img.width());
+    fill(TensorData(tensor_), img);
+}
+
+inline Tensor::Tensor(const std::vector<Image>& imgs, size_t begin, size_t end) {
+    assert(begin < end && end <= imgs.size());
+
+    tensor_ = TensorNew4d(end - begin, 3, imgs[begin].height(), imgs[begin].width());
+    for (size_t i = begin; i < end; ++i) {
+        copy(i - begin, imgs[i]);
+    }
+}
+
+inline Tensor::Tensor(size_t n, int h, int w) {
+    tensor_ = TensorNew4d(n, 3, h, w);
 }
 
 inline Tensor::Tensor(FloatTensor* tensor) : tensor_(tensor) {}
 
-inline Tensor::~Tensor() {}
+inline Tensor::Tensor(const Tensor& other) : tensor_(other.tensor_) {
+    if (tensor_)
+        TensorRetain(tensor_);
+}
+
+inline Tensor& Tensor::operator=(const Tensor& other) {
+    if (other.tensor_)
+        TensorRetain(other.tensor_);
+    if (tensor_)
+        TensorFree(tensor_);
+    tensor_ = other.tensor_;
+    return *this;
+}
+
+inline Tensor::~Tensor() {
+    if (tensor_)
+        TensorFree(tensor_);
+}
+
+inline void Tensor::copy(size_t i, const Image& img) {
+    assert(THFloatTensor_nDimension(tensor_) == 4 && (long)i < THFloatTensor_size(tensor_, 0));
+    int h = THFloatTensor_size(tensor_, 2), w = THFloatTensor_size(tensor_, 3);
+    if (img.width() != w || img.height() != h)
+        throw std::runtime_error("Images in a batch must have the same size.");
+    fill(TensorData(tensor_) + i*3*w*h, img);
+}
+
+inline void Tensor::resize(size_t n) {
+    TensorResize4d(tensor_, n, 3, THFloatTensor_size(tensor_, 2), THFloatTensor_size(tensor_, 3));
+}
+
+/**
+ * @brief Recycles Nx3xHxW input tensors between forwards.
+ *
+ * A tensor is handed out again once its refcount dropped back to one, i.e.
+ * the pool holds the only reference and neither C++ nor lua still use it.
+ * At most #capacity tensors are kept. If all of them are in use, the
+ * collect function is called to give lua's garbage collector the chance to
+ * release references of finished forwards, before a tensor is allocated
+ * outside of the pool.
+ */
+class TensorPool {
+public:
+    /**
+     * @brief Constructs an empty pool for images of the given size.
+     *
+     * @param height Height of each image
+     * @param width Width of each image
+     * @param capacity Maximum number of pooled tensors
+     */
+    TensorPool(int height, int width, size_t capacity = TENSOR_POOL_SIZE)
+        : height_(height), width_(width), capacity_(capacity) {}
+
+    /**
+     * @brief Sets the function that releases references held by lua.
+     */
+    void set_collector(std::function<void()> collect) {collect_ = collect;}
+
+    /**
+     * @brief Returns a tensor for #n images, reusing a pooled one if possible.
+     *
+     * @param  n Number of images
+     * @return   Uninitialized Nx3xHxW tensor
+     */
+    Tensor acquire(size_t n);
+
+    /**
+     * @brief Returns the number of pooled tensors.
+     */
+    size_t size() const {return tensors_.size();}
+
+private:
+    /**
+     * @brief Returns the index of a tensor nobody else refers to, or size().
+     */
+    size_t available() {
+        size_t i = 0;
+        while (i < tensors_.size() && tensors_[i].raw()->refcount > 1)
+            ++i;
+        return i;
+    }
+
+    int height_, width_;
+    size_t capacity_;
+    std::vector<Tensor> tensors_;
+    std::function<void()> collect_;
+};
+
+inline Tensor TensorPool::acquire(size_t n) {
+    size_t i = available();
+    if (i == tensors_.size() && i >= capacity_ && collect_) {
+        collect_();
+        i = available();
+    }
+
+    if (i < tensors_.size()) {
+        tensors_[i].resize(n);
+        return tensors_[i];
+    }
+
+    Tensor tensor(n, height_, width_);
+    if (tensors_.size() < capacity_)
+        tensors_.push_back(tensor);
+    return tensor;
+}
 
 #endif
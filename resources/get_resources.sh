@@ -19,7 +19,18 @@ $GETCMD http://dlib.net/files/shape_predictor_68_face_landmarks.dat.bz2
 hash bunzip2 2>/dev/null || { echo >&2 "I require bunzip2 but it's not installed. Aborting."; exit 1; }
 bunzip2 shape_predictor_68_face_landmarks.dat.bz2;
 
+# Get the compact 5 point face shape for the fast alignment
+$GETCMD http://dlib.net/files/shape_predictor_5_face_landmarks.dat.bz2
+bunzip2 shape_predictor_5_face_landmarks.dat.bz2;
+
 # Get front face haarcascade classifier
 $GETCMD https://raw.githubusercontent.com/Itseez/opencv/master/data/haarcascades/haarcascade_frontalface_alt.xml
 
+# Convert the neural network for the native C++ backend, requires torch
+if hash th 2>/dev/null; then
+  th ../src/openface/convert_nn.lua nn4.v2.t7 nn4.v2.ofnn
+else
+  echo "th not found, skipping conversion of nn4.v2.t7 for the native backend."
+fi
+
 echo "Done."
@@ -22,7 +22,7 @@ Image::Image(cv::Mat& mat) {
 }
 
 Image::Image(const Image& img, const Rectangle& rect) {
-    mat_ = cv::UMat(img.cloneCVImage(), notEmpty(rectInsideImg(img, rect)).asCVRect());
+    cv::UMat(img.mat_, notEmpty(rectInsideImg(img, rect)).asCVRect()).copyTo(mat_);
     dlibimg_ = DLIBImage(mat_.getMat(cv::ACCESS_READ | cv::ACCESS_WRITE));
     safe_ = true;
 }
@@ -63,7 +63,35 @@ void Image::load(const std::string &path) {
 }
 
 void Image::warpAffine(const cv::Mat& warpMat, cv::Size size) {
-    cv::warpAffine(mat_, mat_, warpMat, size);
+    // Find the source region that is mapped into the result
+    cv::Mat inv;
+    cv::invertAffineTransform(warpMat, inv);
+    std::vector<cv::Point2f> corners;
+    corners.push_back(cv::Point2f(0, 0));
+    corners.push_back(cv::Point2f(size.width, 0));
+    corners.push_back(cv::Point2f(0, size.height));
+    corners.push_back(cv::Point2f(size.width, size.height));
+    cv::transform(corners, corners, inv);
+
+    // Padded by the reach of the bilinear interpolation
+    cv::Rect roi = cv::boundingRect(corners);
+    roi = cv::Rect(roi.x - 2, roi.y - 2, roi.width + 4, roi.height + 4) & cv::Rect(0, 0, width(), height());
+
+    cv::UMat warped;
+    if (roi.area() == 0) {
+        warped = cv::UMat(size, mat_.type(), cv::Scalar::all(0));
+    }
+    else {
+        // Move the origin of the transformation to the region
+        cv::Mat H;
+        warpMat.convertTo(H, CV_64F);
+        H.at<double>(0, 2) += H.at<double>(0, 0)*roi.x + H.at<double>(0, 1)*roi.y;
+        H.at<double>(1, 2) += H.at<double>(1, 0)*roi.x + H.at<double>(1, 1)*roi.y;
+        cv::warpAffine(cv::UMat(mat_, roi), warped, H, size);
+    }
+
+    mat_ = warped;
+    dlibimg_ = DLIBImage(mat_.getMat(cv::ACCESS_READ | cv::ACCESS_WRITE));
 }
 
 bool Image::safe() {
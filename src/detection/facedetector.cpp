@@ -1,12 +1,18 @@
 #include "detection/facedetector.hpp"
 #include "core/support.hpp"
 
-FaceDetector::FaceDetector() {
+#include <algorithm>
+#include <limits>
+
+FaceDetector::FaceDetector() : single_level_ready_(false), threads_(std::max(1u, std::thread::hardware_concurrency())), scale_(1), min_face_size_(0), score_threshold_(0),
+      haar_score_threshold_(-std::numeric_limits<double>::infinity()), nms_threshold_(0.5), mode_(HOG), cascade_scale_(0.5), fallback_(false), initialized_(false) {
     gpuEnabled = false;
     detector = dlib::get_frontal_face_detector();
 }
 
-FaceDetector::FaceDetector(const std::string& cpu_path, const std::string& gpu_path) {
+FaceDetector::FaceDetector(const std::string& cpu_path, const std::string& gpu_path)
+    : single_level_ready_(false), threads_(std::max(1u, std::thread::hardware_concurrency())), scale_(1), min_face_size_(0), score_threshold_(0),
+      haar_score_threshold_(-std::numeric_limits<double>::infinity()), nms_threshold_(0.5), mode_(HOG), cascade_scale_(0.5), fallback_(false), initialized_(false) {
     gpuEnabled = false;
     detector = dlib::get_frontal_face_detector();
     load(cpu_path, gpu_path);
@@ -15,6 +21,8 @@ FaceDetector::FaceDetector(const std::string& cpu_path, const std::string& gpu_p
 void FaceDetector::load(const std::string &cpu_path, const std::string &gpu_path) {
     if (!cv_detector.load(cpu_path))
         throw std::runtime_error("No haarcascade classifier found. Run get_resources.sh");
+    cpu_path_ = cpu_path;
+    workers_.clear();
 #ifdef CUDA_SUPPORT
     if (cv::cuda::getCudaEnabledDeviceCount() > 0) {
         gpu_detector = cv::cuda::CascadeClassifier::create(gpu_path);
@@ -33,7 +41,11 @@ bool FaceDetector::verifyDetection(const Image& img, const Rectangle& rect) {
 }
 
 Detection FaceDetector::detect(const Image& img) {
-    return dlib_detect(img);
+    if (mode_ == HOG)
+        return dlib_detect(img);
+
+    std::vector<Detection> ds = detect_all(img);
+    return ds.empty() ? Detection() : ds[0];
 }
 
 #ifdef CUDA_SUPPORT
@@ -51,29 +63,198 @@ void FaceDetector::gpu_detect(const cv::cuda::GpuMat& img) {
 }
 #endif
 
+std::vector<Detection> FaceDetector::detect_all(const Image& img) {
+    switch (mode_) {
+    case HAAR:
+        return cv_detect_all(img);
+    case CASCADE:
+        return cascade_detect_all(img);
+    case HOG_PARALLEL:
+        return dlib_parallel_detect_all(img);
+    default:
+        return dlib_detect_all(img);
+    }
+}
+
+std::vector<Detection> FaceDetector::detect_all(const Image& img, const Rectangle& region) {
+    return detections(img, dlib_candidates(img, region));
+}
+
+void FaceDetector::set_threads(int threads) {
+    if (threads <= 0)
+        throw std::runtime_error("Number of threads must be positive.");
+    threads_ = threads;
+}
+
+void FaceDetector::set_scale(double scale) {
+    if (scale <= 0 || scale > 1)
+        throw std::runtime_error("Detection scale must be in (0, 1].");
+    scale_ = scale;
+}
+
+void FaceDetector::set_min_face_size(int size) {
+    if (size <= 0)
+        throw std::runtime_error("Minimum face size must be positive.");
+    scale_ = std::min(1., (double)DETECTOR_WINDOW_SIZE / size);
+    min_face_size_ = size;
+}
+
+void FaceDetector::set_mode(DetectionMode mode) {
+    mode_ = mode;
+}
+
+void FaceDetector::set_cascade_scale(double scale) {
+    if (scale <= 0 || scale > 1)
+        throw std::runtime_error("Cascade scale must be in (0, 1].");
+    cascade_scale_ = scale;
+}
+
+void FaceDetector::copy_settings(const FaceDetector& other) {
+    scale_ = other.scale_;
+    min_face_size_ = other.min_face_size_;
+    score_threshold_ = other.score_threshold_;
+    haar_score_threshold_ = other.haar_score_threshold_;
+    nms_threshold_ = other.nms_threshold_;
+    mode_ = other.mode_;
+    cascade_scale_ = other.cascade_scale_;
+    fallback_ = other.fallback_;
+}
+
+FaceDetector& FaceDetector::worker(int i) {
+    if (i == 0)
+        return *this;
+    return *workers_[i - 1];
+}
+
+void FaceDetector::create_workers(int threads) {
+    // Create the missing detectors up front, the workers only read workers_.
+    while ((int)workers_.size() < threads - 1) {
+        std::shared_ptr<FaceDetector> fd = std::make_shared<FaceDetector>();
+        if (!cpu_path_.empty())
+            fd->load(cpu_path_, "");
+        fd->set_threads(1);
+        workers_.push_back(fd);
+    }
+    for (size_t i = 0; i < workers_.size(); i++)
+        workers_[i]->copy_settings(*this);
+}
+
 std::vector<Detection> FaceDetector::detect(const std::vector<Image>& images) {
-    std::vector<Detection> ds;
+    std::vector<Detection> ds(images.size());
 
-    for (size_t i = 0; i < images.size(); i++) {
-        Detection d = detect(images[i]);
-        ds.push_back(d);
+    int threads = std::min<int>(threads_, images.size());
+    create_workers(threads);
+
+    // Worker 0 is this detector, in HOG_PARALLEL mode its level scan would
+    // drive the other workers while they detect, so it scans serially.
+    int level_threads = threads_;
+    if (threads > 1)
+        threads_ = 1;
+    parallel_for_worker(images.size(), threads, [&](size_t i, int w) {
+        ds[i] = worker(w).detect(images[i]);
+    });
+    threads_ = level_threads;
+
+    return ds;
+}
+
+std::vector<Detection> non_max_suppression(std::vector<Detection> ds, double max_overlap) {
+    std::stable_sort(ds.begin(), ds.end(), [](const Detection& a, const Detection& b) {
+        return a.score > b.score;
+    });
+
+    std::vector<Detection> kept;
+    for (size_t i = 0; i < ds.size(); i++) {
+        bool overlaps = false;
+        for (size_t j = 0; j < kept.size() && !overlaps; j++)
+            overlaps = ds[i].rect.iou(kept[j].rect) > max_overlap;
+        if (!overlaps)
+            kept.push_back(ds[i]);
+    }
+    return kept;
+}
+
+std::vector<Detection> FaceDetector::detections(const Image& img, const std::vector<Detection>& candidates) {
+    std::vector<Detection> ds;
+    ds.reserve(candidates.size());
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const Detection& c = candidates[i];
+        if (!verifyDetection(img, c.rect) || c.rect.width() < min_face_size_)
+            continue;
+        ds.push_back(c);
+        ds.back().face = img;
     }
+    return non_max_suppression(ds, nms_threshold_);
+}
+
+std::vector<Detection> FaceDetector::dlib_candidates(const Image& img) {
+    if (scale_ < 1)
+        return dlib_candidates(img, Rectangle(0, 0, img.width(), img.height()));
 
+    std::vector<dlib::rect_detection> faces;
+    detector(img.asDLIBImage(), faces, score_threshold_);
+
+    std::vector<Detection> ds(faces.size());
+    for (size_t i = 0; i < faces.size(); i++) {
+        ds[i].rect = Rectangle(faces[i].rect);
+        ds[i].score = faces[i].detection_confidence;
+        ds[i].weight_index = faces[i].weight_index;
+    }
     return ds;
 }
 
-Detection FaceDetector::dlib_detect(const Image& img) {
-    std::vector<dlib::rectangle> faces = detector(img.asDLIBImage());
+std::vector<Detection> FaceDetector::dlib_candidates(const Image& img, const Rectangle& region) {
+    cv::Rect roi = region.asCVRect() & cv::Rect(0, 0, img.width(), img.height());
+    if (roi.area() == 0)
+        return std::vector<Detection>();
 
-    if(faces.size() > 0 && verifyDetection(img, Rectangle(faces[0]))) {
-        Detection d;
-        d.face = img;
-        d.rect = Rectangle(faces[0]);
-        return d;
+    cv::Mat frame = img.asConstCVImage().getMat(cv::ACCESS_READ);
+    std::vector<dlib::rect_detection> faces;
+    if (scale_ < 1) {
+        cv::Mat small;
+        cv::resize(frame(roi), small, cv::Size(), scale_, scale_, cv::INTER_AREA);
+        detector(dlib::cv_image<dlib::bgr_pixel>(small), faces, score_threshold_);
     }
     else {
-        return Detection();
+        detector(dlib::cv_image<dlib::bgr_pixel>(frame(roi)), faces, score_threshold_);
+    }
+
+    std::vector<Detection> ds(faces.size());
+    for (size_t i = 0; i < faces.size(); i++) {
+        Rectangle rect = Rectangle(faces[i].rect).scale(1 / scale_);
+        ds[i].rect = Rectangle(rect.x() + roi.x, rect.y() + roi.y, rect.width(), rect.height());
+        ds[i].score = faces[i].detection_confidence;
+        ds[i].weight_index = faces[i].weight_index;
+    }
+    return ds;
+}
+
+std::vector<Detection> FaceDetector::cv_candidates(cv::InputArray img, int min_neighbors, int min_size) {
+    std::vector<cv::Rect> faces;
+    std::vector<int> levels;
+    std::vector<double> weights;
+    cv_detector.detectMultiScale(img, faces, levels, weights, 1.1, min_neighbors,
+                                 0|CV_HAAR_SCALE_IMAGE, cv::Size(min_size, min_size), cv::Size(), true);
+
+    std::vector<Detection> ds;
+    for (size_t i = 0; i < faces.size(); i++) {
+        if (weights[i] < haar_score_threshold_)
+            continue;
+        Detection d;
+        d.rect = Rectangle(faces[i]);
+        d.score = weights[i];
+        ds.push_back(d);
     }
+    return ds;
+}
+
+Detection FaceDetector::dlib_detect(const Image& img) {
+    std::vector<Detection> ds = dlib_detect_all(img);
+    return ds.empty() ? Detection() : ds[0];
+}
+
+std::vector<Detection> FaceDetector::dlib_detect_all(const Image& img) {
+    return detections(img, dlib_candidates(img));
 }
 
 void FaceDetector::nogpu_detect(const cv::Mat& img) {
@@ -84,16 +265,210 @@ void FaceDetector::nogpu_detect(const cv::Mat& img) {
 
 Detection FaceDetector::cv_detect(const Image& img) {
     assert(initialized_);
-    std::vector<cv::Rect> faces;
-    cv_detector.detectMultiScale(img.asConstCVImage(), faces, 1.1, 2, 0|CV_HAAR_SCALE_IMAGE, cv::Size(30, 30) );
+    std::vector<Detection> ds = detections(img, cv_candidates(img.asConstCVImage(), 2, 30));
 
-    if(faces.size() > 0 && verifyDetection(img, Rectangle(faces[0]))) {
-        Detection d;
-        d.face = Face(Image(img, Rectangle(faces[0])));
-        d.rect = Rectangle(faces[0]);
+    if(ds.size() > 0) {
+        Detection d = ds[0];
+        d.face = Face(Image(img, d.rect));
         return d;
     }
     else {
         return Detection();
     }
 }
+
+std::vector<Detection> FaceDetector::cv_detect_all(const Image& img) {
+    assert(initialized_);
+    return detections(img, cv_candidates(img.asConstCVImage(), 2, 30));
+}
+
+std::vector<Rectangle> FaceDetector::cascade_regions(const std::vector<Detection>& candidates, double scale) const {
+    std::vector<Rectangle> regions;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        Rectangle r = candidates[i].rect.scale(1 / scale);
+        int pad = std::max(r.width(), DETECTOR_WINDOW_SIZE) / 2;
+        regions.push_back(Rectangle(r.x() - pad, r.y() - pad, r.width() + 2*pad, r.height() + 2*pad));
+    }
+    return merge_overlapping(regions);
+}
+
+std::vector<Detection> FaceDetector::cascade_detect_all(const Image& img) {
+    assert(initialized_);
+    cv::Mat small;
+    cv::resize(img.asConstCVImage(), small, cv::Size(), cascade_scale_, cascade_scale_, cv::INTER_AREA);
+
+    // Fewer neighbors than cv_detect, false candidates are rejected by HOG.
+    std::vector<Rectangle> regions = cascade_regions(cv_candidates(small, 1, 20), cascade_scale_);
+
+    std::vector<Detection> ds;
+    for (size_t i = 0; i < regions.size(); i++) {
+        std::vector<Detection> found = dlib_candidates(img, regions[i]);
+        ds.insert(ds.end(), found.begin(), found.end());
+    }
+
+    if (ds.empty() && fallback_)
+        return dlib_detect_all(img);
+    return detections(img, ds);
+}
+
+dlib::frontal_face_detector& FaceDetector::single_level_detector() {
+    if (!single_level_ready_) {
+        typedef dlib::frontal_face_detector::image_scanner_type Scanner;
+        Scanner scanner;
+        scanner.copy_configuration(detector.get_scanner());
+        scanner.set_max_pyramid_levels(1);
+
+        std::vector<dlib::frontal_face_detector::feature_vector_type> w;
+        for (unsigned long i = 0; i < detector.num_detectors(); i++)
+            w.push_back(detector.get_w(i));
+        // Nothing overlaps, the levels are merged with the overlap tester of #detector
+        single_level_ = dlib::frontal_face_detector(scanner, dlib::test_box_overlap(1, 1), w);
+        single_level_ready_ = true;
+    }
+    return single_level_;
+}
+
+std::vector<Detection> FaceDetector::dlib_candidates(const PreparedImage& img) {
+    // Levels larger than the detection scale are skipped, like set_scale()
+    std::vector<size_t> levels;
+    for (size_t i = 0; i < img.levels(); i++) {
+        if (img.scale(i) <= scale_ * (1 + 1e-6))
+            levels.push_back(i);
+    }
+
+    // In HOG_PARALLEL mode the levels are scanned by the workers like in parallel_scan()
+    int threads = mode_ == HOG_PARALLEL ? std::min<int>(threads_, levels.size()) : 1;
+    if (threads > 1)
+        create_workers(threads);
+    std::vector<std::vector<dlib::rect_detection> > found(levels.size());
+    parallel_for_worker(levels.size(), threads, [&](size_t i, int w) {
+        worker(w).single_level_detector()(img.level(levels[i]), found[i], score_threshold_);
+    });
+
+    std::vector<Detection> ds;
+    for (size_t i = 0; i < levels.size(); i++) {
+        for (size_t j = 0; j < found[i].size(); j++) {
+            Detection d;
+            d.rect = img.to_image(found[i][j].rect, levels[i]);
+            d.score = found[i][j].detection_confidence;
+            d.weight_index = found[i][j].weight_index;
+            ds.push_back(d);
+        }
+    }
+
+    // Merge the levels like the detector merges its own pyramid
+    std::stable_sort(ds.begin(), ds.end(), [](const Detection& a, const Detection& b) {
+        return a.score > b.score;
+    });
+    const dlib::test_box_overlap& overlaps = detector.get_overlap_tester();
+    std::vector<Detection> kept;
+    for (size_t i = 0; i < ds.size(); i++) {
+        bool overlap = false;
+        for (size_t j = 0; j < kept.size() && !overlap; j++)
+            overlap = overlaps(ds[i].rect.asDLIBRect(), kept[j].rect.asDLIBRect());
+        if (!overlap)
+            kept.push_back(ds[i]);
+    }
+    return kept;
+}
+
+std::vector<Detection> FaceDetector::detect_all(const PreparedImage& img) {
+    if (mode_ == HAAR) {
+        assert(initialized_);
+        return detections(img.image(), cv_candidates(img.gray_mat(), 2, 30));
+    }
+    if (mode_ == HOG || mode_ == HOG_PARALLEL)
+        return detections(img.image(), dlib_candidates(img));
+
+    assert(initialized_);
+    size_t level = 0;
+    for (size_t i = 1; i < img.levels(); i++) {
+        if (std::abs(img.scale(i) - cascade_scale_) < std::abs(img.scale(level) - cascade_scale_))
+            level = i;
+    }
+    std::vector<Rectangle> regions = cascade_regions(cv_candidates(img.level_mat(level), 1, 20), img.scale(level));
+
+    std::vector<Detection> ds;
+    for (size_t i = 0; i < regions.size(); i++) {
+        std::vector<Detection> found = dlib_candidates(img.image(), regions[i]);
+        ds.insert(ds.end(), found.begin(), found.end());
+    }
+
+    if (ds.empty() && fallback_)
+        return detections(img.image(), dlib_candidates(img));
+    return detections(img.image(), ds);
+}
+
+std::vector<Detection> FaceDetector::dlib_parallel_detect_all(const Image& img) {
+    cv::Mat frame = img.asConstCVImage().getMat(cv::ACCESS_READ);
+    cv::Mat small = frame;
+    if (scale_ < 1)
+        cv::resize(frame, small, cv::Size(), scale_, scale_, cv::INTER_AREA);
+
+    std::vector<dlib::rect_detection> faces = parallel_scan(dlib::cv_image<dlib::bgr_pixel>(small));
+
+    std::vector<Detection> ds(faces.size());
+    for (size_t i = 0; i < faces.size(); i++) {
+        ds[i].rect = Rectangle(faces[i].rect).scale(1 / scale_);
+        ds[i].score = faces[i].detection_confidence;
+        ds[i].weight_index = faces[i].weight_index;
+    }
+    return detections(img, ds);
+}
+
+std::vector<dlib::rect_detection> FaceDetector::parallel_scan(const dlib::cv_image<dlib::bgr_pixel>& img) {
+    const dlib::frontal_face_detector::image_scanner_type& scanner = detector.get_scanner();
+    dlib::pyramid_down<6> pyramid;
+
+    // Count the levels like scan_fhog_pyramid::load() does
+    size_t n = 0;
+    dlib::rectangle rect = dlib::get_rect(img);
+    do {
+        rect = pyramid.rect_down(rect);
+        n++;
+    } while (rect.width() >= scanner.get_min_pyramid_layer_width()
+             && rect.height() >= scanner.get_min_pyramid_layer_height()
+             && n < scanner.get_max_pyramid_levels());
+
+    // Level 0 is #img itself, levels[i - 1] is level i
+    dlib::array<dlib::array2d<dlib::bgr_pixel> > levels;
+    levels.resize(n - 1);
+    for (size_t i = 1; i < n; i++) {
+        if (i == 1)
+            pyramid(img, levels[0]);
+        else
+            pyramid(levels[i - 2], levels[i - 1]);
+    }
+
+    // The largest levels come first and keep the threads busy the longest
+    int threads = std::min<int>(threads_, n);
+    if (threads > 1)
+        create_workers(threads);
+    std::vector<std::vector<dlib::rect_detection> > found(n);
+    parallel_for_worker(n, threads, [&](size_t i, int w) {
+        dlib::frontal_face_detector& single = worker(w).single_level_detector();
+        if (i == 0)
+            single(img, found[i], score_threshold_);
+        else
+            single(levels[i - 1], found[i], score_threshold_);
+        for (size_t j = 0; j < found[i].size(); j++)
+            found[i][j].rect = pyramid.rect_up(found[i][j].rect, i);
+    });
+
+    // Merge the levels exactly like object_detector::operator() merges its pyramid
+    std::vector<dlib::rect_detection> dets;
+    for (size_t i = 0; i < n; i++)
+        dets.insert(dets.end(), found[i].begin(), found[i].end());
+    std::sort(dets.rbegin(), dets.rend());
+
+    const dlib::test_box_overlap& overlaps = detector.get_overlap_tester();
+    std::vector<dlib::rect_detection> kept;
+    for (size_t i = 0; i < dets.size(); i++) {
+        bool overlap = false;
+        for (size_t j = 0; j < kept.size() && !overlap; j++)
+            overlap = overlaps(dets[i].rect, kept[j].rect);
+        if (!overlap)
+            kept.push_back(dets[i]);
+    }
+    return kept;
+}
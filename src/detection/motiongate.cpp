@@ -0,0 +1,89 @@
+#include "detection/motiongate.hpp"
+
+MotionGate::MotionGate(FaceDetector& fd, double scale, int threshold, int min_pixels)
+    : fd_(fd), scale_(scale), threshold_(threshold), min_pixels_(min_pixels), frames_(0), hits_(0) {
+    if (scale <= 0 || scale > 1)
+        throw std::runtime_error("Motion scale must be in (0, 1].");
+}
+
+void MotionGate::reset() {
+    reference_ = cv::Mat();
+    detections_.clear();
+}
+
+cv::Mat MotionGate::small(const Image& frame) const {
+    cv::Mat resized, gray;
+    cv::resize(frame.asConstCVImage(), resized, cv::Size(), scale_, scale_, cv::INTER_AREA);
+    cv::cvtColor(resized, gray, cv::COLOR_BGR2GRAY);
+    return gray;
+}
+
+std::vector<Rectangle> MotionGate::regions(cv::Mat& mask, const Image& frame) const {
+    std::vector<std::vector<cv::Point> > contours;
+    cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+    // A face that only partly moved must fit into the region, with the
+    // margin the detector needs around it.
+    const int margin = DETECTOR_WINDOW_SIZE;
+    const cv::Rect bounds(0, 0, frame.width(), frame.height());
+    std::vector<Rectangle> rects;
+    for (size_t i = 0; i < contours.size(); i++) {
+        cv::Rect r = cv::boundingRect(contours[i]);
+        cv::Rect full(cvRound(r.x / scale_) - margin, cvRound(r.y / scale_) - margin,
+                      cvRound(r.width / scale_) + 2*margin, cvRound(r.height / scale_) + 2*margin);
+        for (size_t j = 0; j < detections_.size(); j++) {
+            cv::Rect d = detections_[j].rect.asCVRect();
+            if ((d & full).area() > 0)
+                full |= cv::Rect(d.x - margin/2, d.y - margin/2, d.width + margin, d.height + margin);
+        }
+        rects.push_back(full & bounds);
+    }
+
+    // Merge overlapping regions, so no face is detected twice
+    return merge_overlapping(rects);
+}
+
+std::vector<Detection> MotionGate::detect_all(const Image& frame) {
+    frames_++;
+    cv::Mat current = small(frame);
+
+    if (reference_.empty() || reference_.size() != current.size()) {
+        detections_ = fd_.detect_all(frame);
+        reference_ = current;
+        return detections_;
+    }
+
+    cv::Mat diff, mask;
+    cv::absdiff(current, reference_, diff);
+    cv::threshold(diff, mask, threshold_, 255, cv::THRESH_BINARY);
+
+    if (cv::countNonZero(mask) < min_pixels_) {
+        hits_++;
+        for (size_t i = 0; i < detections_.size(); i++)
+            detections_[i].face = frame;
+        return detections_;
+    }
+
+    cv::dilate(mask, mask, cv::Mat());
+    std::vector<Rectangle> changed = regions(mask, frame);
+
+    std::vector<Detection> ds;
+    for (size_t i = 0; i < detections_.size(); i++) {
+        bool moved = false;
+        for (size_t j = 0; j < changed.size() && !moved; j++)
+            moved = (detections_[i].rect.asCVRect() & changed[j].asCVRect()).area() > 0;
+        if (!moved) {
+            ds.push_back(detections_[i]);
+            ds.back().face = frame;
+        }
+    }
+    for (size_t j = 0; j < changed.size(); j++) {
+        std::vector<Detection> found = fd_.detect_all(frame, changed[j]);
+        ds.insert(ds.end(), found.begin(), found.end());
+    }
+
+    // Kept and new detections can overlap at the border of a region
+    detections_ = non_max_suppression(ds, fd_.nms_threshold());
+    reference_ = current;
+    return detections_;
+}
@@ -0,0 +1,23 @@
+#include "detection/preparedimage.hpp"
+
+PreparedImage::PreparedImage(const Image& img, int min_size) : image_(img) {
+    levels_.resize(1);
+    dlib::assign_image(levels_[0], img.asDLIBImage());
+
+    while (true) {
+        GrayImage next;
+        pyramid_(levels_[levels_.size() - 1], next);
+        if (next.nr() < min_size || next.nc() < min_size)
+            break;
+        levels_.push_back(next);
+    }
+}
+
+cv::Mat PreparedImage::level_mat(size_t i) const {
+    GrayImage& level = const_cast<GrayImage&>(levels_[i]);
+    return dlib::toMat(level);
+}
+
+Rectangle PreparedImage::to_image(const DLIBRect& rect, size_t i) const {
+    return Rectangle(pyramid_.rect_up(rect, i));
+}
@@ -0,0 +1,111 @@
+#include "detection/videosession.hpp"
+
+#include <limits>
+
+constexpr double VideoSession::MIN_OVERLAP;
+
+VideoSession::VideoSession(FaceDetector& fd, int keyframe_interval, double min_confidence)
+    : fd_(fd), min_confidence_(min_confidence), frames_since_keyframe_(-1), next_id_(0), keyframe_(false) {
+    set_keyframe_interval(keyframe_interval);
+    set_empty_interval(keyframe_interval);
+}
+
+void VideoSession::set_keyframe_interval(int interval) {
+    if (interval <= 0)
+        throw std::runtime_error("Keyframe interval must be positive.");
+    keyframe_interval_ = interval;
+}
+
+void VideoSession::set_empty_interval(int interval) {
+    if (interval <= 0)
+        throw std::runtime_error("Empty scene interval must be positive.");
+    empty_interval_ = interval;
+}
+
+void VideoSession::reset() {
+    states_.clear();
+    frames_since_keyframe_ = -1;
+    keyframe_ = false;
+}
+
+std::vector<Track> VideoSession::process(const Image& frame) {
+    frame_ = frame;
+    // Without tracks there is nothing to follow, new faces are only found by
+    // the detector every empty_interval() frames
+    int interval = states_.empty() ? empty_interval_ : keyframe_interval_;
+    keyframe_ = frames_since_keyframe_ < 0 || frames_since_keyframe_ + 1 >= interval;
+
+    if (!keyframe_ && !update(frame))
+        keyframe_ = true;
+
+    if (keyframe_) {
+        detect(frame);
+        frames_since_keyframe_ = 0;
+    }
+    else {
+        frames_since_keyframe_++;
+    }
+
+    return tracks();
+}
+
+std::vector<Track> VideoSession::tracks() const {
+    std::vector<Track> out(states_.size());
+    for (size_t i = 0; i < states_.size(); i++) {
+        out[i].id = states_[i].id;
+        out[i].detection.face = frame_;
+        out[i].detection.rect = states_[i].rect;
+        out[i].confidence = states_[i].confidence;
+    }
+    return out;
+}
+
+bool VideoSession::update(const Image& frame) {
+    const Rectangle bounds(0, 0, frame.width(), frame.height());
+    bool lost = false;
+
+    for (size_t i = 0; i < states_.size(); i++) {
+        State& s = states_[i];
+        s.confidence = s.tracker.update(frame.asDLIBImage());
+        DLIBRect position = s.tracker.get_position();
+        s.rect = Rectangle(position.intersect(bounds.asDLIBRect()));
+        if (s.confidence < min_confidence_ || s.rect.area() == 0)
+            lost = true;
+    }
+
+    return !lost;
+}
+
+void VideoSession::detect(const Image& frame) {
+    std::vector<Detection> ds = fd_.detect_all(frame);
+    std::vector<State> states;
+    std::vector<bool> matched(states_.size(), false);
+
+    for (size_t i = 0; i < ds.size(); i++) {
+        // Continue the track overlapping most with the detection
+        int best = -1;
+        double best_overlap = MIN_OVERLAP;
+        for (size_t j = 0; j < states_.size(); j++) {
+            double overlap = ds[i].rect.iou(states_[j].rect);
+            if (!matched[j] && overlap >= best_overlap) {
+                best = j;
+                best_overlap = overlap;
+            }
+        }
+
+        State s;
+        if (best >= 0) {
+            matched[best] = true;
+            s.id = states_[best].id;
+        }
+        else {
+            s.id = next_id_++;
+        }
+        s.rect = ds[i].rect;
+        s.confidence = std::numeric_limits<double>::infinity();
+        s.tracker.start_track(frame.asDLIBImage(), dlib::drectangle(s.rect.asDLIBRect()));
+        states.push_back(s);
+    }
+
+    states_.swap(states);
+}
@@ -0,0 +1,193 @@
+#include "learning/distance.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DISTANCE_X86
+#include <immintrin.h>
+#endif
+
+void squared_distances_scalar(const float* query, const float* rows, size_t n, size_t dims, float* out) {
+    for (size_t i = 0; i < n; ++i) {
+        const float* row = rows + i*dims;
+        float sum = 0;
+        for (size_t j = 0; j < dims; ++j) {
+            float d = row[j] - query[j];
+            sum += d * d;
+        }
+        out[i] = sum;
+    }
+}
+
+void dot_products_scalar(const float* query, const float* rows, size_t n, size_t dims, float* out) {
+    for (size_t i = 0; i < n; ++i) {
+        const float* row = rows + i*dims;
+        float sum = 0;
+        for (size_t j = 0; j < dims; ++j)
+            sum += row[j] * query[j];
+        out[i] = sum;
+    }
+}
+
+#ifdef DISTANCE_X86
+
+/**
+ * Sums the eight floats of a register.
+ */
+__attribute__((target("avx2")))
+static inline float horizontal_sum(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+void squared_distances_avx2(const float* query, const float* rows, size_t n, size_t dims, float* out) {
+    const size_t simd = dims & ~size_t(31);
+    for (size_t i = 0; i < n; ++i) {
+        const float* row = rows + i*dims;
+        // Four independent sums hide the latency of the fused multiply-add
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+        for (size_t j = 0; j < simd; j += 32) {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(row + j), _mm256_loadu_ps(query + j));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(row + j + 8), _mm256_loadu_ps(query + j + 8));
+            __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(row + j + 16), _mm256_loadu_ps(query + j + 16));
+            __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(row + j + 24), _mm256_loadu_ps(query + j + 24));
+            s0 = _mm256_fmadd_ps(d0, d0, s0);
+            s1 = _mm256_fmadd_ps(d1, d1, s1);
+            s2 = _mm256_fmadd_ps(d2, d2, s2);
+            s3 = _mm256_fmadd_ps(d3, d3, s3);
+        }
+        float sum = horizontal_sum(_mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+        for (size_t j = simd; j < dims; ++j) {
+            float d = row[j] - query[j];
+            sum += d * d;
+        }
+        out[i] = sum;
+    }
+}
+
+__attribute__((target("avx512f")))
+void squared_distances_avx512(const float* query, const float* rows, size_t n, size_t dims, float* out) {
+    const size_t simd = dims & ~size_t(31);
+    for (size_t i = 0; i < n; ++i) {
+        const float* row = rows + i*dims;
+        __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+        for (size_t j = 0; j < simd; j += 32) {
+            __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(row + j), _mm512_loadu_ps(query + j));
+            __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(row + j + 16), _mm512_loadu_ps(query + j + 16));
+            s0 = _mm512_fmadd_ps(d0, d0, s0);
+            s1 = _mm512_fmadd_ps(d1, d1, s1);
+        }
+        float lanes[16];
+        _mm512_storeu_ps(lanes, _mm512_add_ps(s0, s1));
+        float sum = 0;
+        for (int j = 0; j < 16; ++j)
+            sum += lanes[j];
+        for (size_t j = simd; j < dims; ++j) {
+            float d = row[j] - query[j];
+            sum += d * d;
+        }
+        out[i] = sum;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void dot_products_avx2(const float* query, const float* rows, size_t n, size_t dims, float* out) {
+    const size_t simd = dims & ~size_t(31);
+    for (size_t i = 0; i < n; ++i) {
+        const float* row = rows + i*dims;
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+        for (size_t j = 0; j < simd; j += 32) {
+            s0 = _mm256_fmadd_ps(_mm256_loadu_ps(row + j), _mm256_loadu_ps(query + j), s0);
+            s1 = _mm256_fmadd_ps(_mm256_loadu_ps(row + j + 8), _mm256_loadu_ps(query + j + 8), s1);
+            s2 = _mm256_fmadd_ps(_mm256_loadu_ps(row + j + 16), _mm256_loadu_ps(query + j + 16), s2);
+            s3 = _mm256_fmadd_ps(_mm256_loadu_ps(row + j + 24), _mm256_loadu_ps(query + j + 24), s3);
+        }
+        float sum = horizontal_sum(_mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+        for (size_t j = simd; j < dims; ++j)
+            sum += row[j] * query[j];
+        out[i] = sum;
+    }
+}
+
+__attribute__((target("avx512f")))
+void dot_products_avx512(const float* query, const float* rows, size_t n, size_t dims, float* out) {
+    const size_t simd = dims & ~size_t(31);
+    for (size_t i = 0; i < n; ++i) {
+        const float* row = rows + i*dims;
+        __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+        for (size_t j = 0; j < simd; j += 32) {
+            s0 = _mm512_fmadd_ps(_mm512_loadu_ps(row + j), _mm512_loadu_ps(query + j), s0);
+            s1 = _mm512_fmadd_ps(_mm512_loadu_ps(row + j + 16), _mm512_loadu_ps(query + j + 16), s1);
+        }
+        float lanes[16];
+        _mm512_storeu_ps(lanes, _mm512_add_ps(s0, s1));
+        float sum = 0;
+        for (int j = 0; j < 16; ++j)
+            sum += lanes[j];
+        for (size_t j = simd; j < dims; ++j)
+            sum += row[j] * query[j];
+        out[i] = sum;
+    }
+}
+
+#else
+
+void squared_distances_avx2(const float*, const float*, size_t, size_t, float*) {
+    throw std::runtime_error("AVX2 is not available on this platform.");
+}
+
+void squared_distances_avx512(const float*, const float*, size_t, size_t, float*) {
+    throw std::runtime_error("AVX-512 is not available on this platform.");
+}
+
+void dot_products_avx2(const float*, const float*, size_t, size_t, float*) {
+    throw std::runtime_error("AVX2 is not available on this platform.");
+}
+
+void dot_products_avx512(const float*, const float*, size_t, size_t, float*) {
+    throw std::runtime_error("AVX-512 is not available on this platform.");
+}
+
+#endif
+
+bool squared_distances_supported(const char* isa) {
+    if (strcmp(isa, "scalar") == 0)
+        return true;
+#ifdef DISTANCE_X86
+    if (strcmp(isa, "avx2") == 0)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (strcmp(isa, "avx512f") == 0)
+        return __builtin_cpu_supports("avx512f");
+#endif
+    return false;
+}
+
+const char* squared_distances_isa() {
+    static const char* isa = squared_distances_supported("avx512f") ? "avx512f" :
+                             squared_distances_supported("avx2") ? "avx2" : "scalar";
+    return isa;
+}
+
+void squared_distances(const float* query, const float* rows, size_t n, size_t dims, float* out) {
+    typedef void (*Kernel)(const float*, const float*, size_t, size_t, float*);
+    static const Kernel kernel =
+        strcmp(squared_distances_isa(), "avx512f") == 0 ? squared_distances_avx512 :
+        strcmp(squared_distances_isa(), "avx2") == 0 ? squared_distances_avx2 :
+        squared_distances_scalar;
+    kernel(query, rows, n, dims, out);
+}
+
+void dot_products(const float* query, const float* rows, size_t n, size_t dims, float* out) {
+    typedef void (*Kernel)(const float*, const float*, size_t, size_t, float*);
+    static const Kernel kernel =
+        strcmp(squared_distances_isa(), "avx512f") == 0 ? dot_products_avx512 :
+        strcmp(squared_distances_isa(), "avx2") == 0 ? dot_products_avx2 :
+        dot_products_scalar;
+    kernel(query, rows, n, dims, out);
+}
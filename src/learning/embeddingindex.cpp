@@ -0,0 +1,409 @@
+#include "learning/embeddingindex.hpp"
+#include "learning/distance.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+
+void EmbeddingIndex::add(const std::vector<FaceNetEmbed>& embeddings) {
+    for (size_t i = 0; i < embeddings.size(); i++)
+        add(embeddings[i]);
+}
+
+BruteForceIndex::BruteForceIndex() : threads_(std::max(1u, std::thread::hardware_concurrency())) {}
+
+void BruteForceIndex::add(const FaceNetEmbed& embedding) {
+    const float* e = &embedding(0);
+    data_.insert(data_.end(), e, e + EMBEDDING_DIMS);
+}
+
+void BruteForceIndex::set_threads(int threads) {
+    if (threads <= 0)
+        throw std::runtime_error("Number of threads must be positive.");
+    threads_ = threads;
+}
+
+std::vector<Neighbor> BruteForceIndex::search(const FaceNetEmbed& query, size_t k) const {
+    const size_t n = size();
+    k = std::min(k, n);
+    if (k == 0)
+        return std::vector<Neighbor>();
+
+    const size_t shards = std::max<size_t>(1, std::min<size_t>(threads_, n / MIN_SHARD_SIZE));
+    const size_t shard_size = (n + shards - 1) / shards;
+    const float* q = &query(0);
+
+    // Every shard keeps a max heap of its k nearest embeddings
+    std::vector<std::vector<Neighbor> > heaps(shards);
+    parallel_for(shards, shards, [&](size_t s) {
+        const size_t begin = s * shard_size;
+        const size_t end = std::min(n, begin + shard_size);
+        std::vector<Neighbor>& heap = heaps[s];
+        heap.reserve(k + 1);
+
+        const size_t block = 256;
+        float distances[block];
+        for (size_t i = begin; i < end; i += block) {
+            const size_t m = std::min(block, end - i);
+            squared_distances(q, embedding(i), m, EMBEDDING_DIMS, distances);
+            for (size_t j = 0; j < m; j++) {
+                Neighbor nb(i + j, distances[j]);
+                if (heap.size() < k) {
+                    heap.push_back(nb);
+                    std::push_heap(heap.begin(), heap.end());
+                }
+                else if (nb < heap.front()) {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.back() = nb;
+                    std::push_heap(heap.begin(), heap.end());
+                }
+            }
+        }
+    });
+
+    std::vector<Neighbor> out;
+    for (size_t s = 0; s < shards; s++)
+        out.insert(out.end(), heaps[s].begin(), heaps[s].end());
+    std::partial_sort(out.begin(), out.begin() + k, out.end());
+    out.resize(k);
+    return out;
+}
+
+namespace {
+
+/**
+ * Marks the nodes visited by a search without clearing a flag per node.
+ */
+struct VisitedList {
+    std::vector<unsigned> marks;
+    unsigned tag;
+
+    VisitedList() : tag(0) {}
+
+    void reset(size_t n) {
+        if (marks.size() < n)
+            marks.resize(n, 0);
+        if (++tag == 0) {
+            std::fill(marks.begin(), marks.end(), 0);
+            tag = 1;
+        }
+    }
+
+    bool visit(size_t i) {
+        if (marks[i] == tag)
+            return false;
+        marks[i] = tag;
+        return true;
+    }
+};
+
+thread_local VisitedList visited;
+
+bool farther(const Neighbor& a, const Neighbor& b) {
+    return b < a;
+}
+
+const char HNSW_MAGIC[] = "OFHNSW1";
+
+}
+
+HNSWIndex::HNSWIndex(size_t M, size_t ef_construction, unsigned long seed)
+    : M_(M), ef_construction_(ef_construction), ef_(50), threads_(std::max(1u, std::thread::hardware_concurrency())),
+      entry_(0), max_level_(-1), rng_(seed) {
+    if (M < 2)
+        throw std::runtime_error("HNSW needs at least two links per node.");
+}
+
+void HNSWIndex::set_ef(size_t ef) {
+    if (ef == 0)
+        throw std::runtime_error("Number of candidates must be positive.");
+    ef_ = ef;
+}
+
+void HNSWIndex::set_threads(int threads) {
+    if (threads <= 0)
+        throw std::runtime_error("Number of threads must be positive.");
+    threads_ = threads;
+}
+
+float HNSWIndex::distance(const float* query, NodeId id) const {
+    float d;
+    squared_distances(query, data_.data() + id * EMBEDDING_DIMS, 1, EMBEDDING_DIMS, &d);
+    return d;
+}
+
+void HNSWIndex::append(const FaceNetEmbed& embedding) {
+    const float* e = &embedding(0);
+    data_.insert(data_.end(), e, e + EMBEDDING_DIMS);
+
+    // Layers are exponentially distributed, one in M nodes reaches the next
+    std::uniform_real_distribution<double> uniform(0, 1);
+    int level = (int)(-std::log(1 - uniform(rng_)) / std::log((double)M_));
+    levels_.push_back(level);
+    links_.push_back(std::vector<std::vector<NodeId> >(level + 1));
+    locks_.emplace_back();
+}
+
+void HNSWIndex::add(const FaceNetEmbed& embedding) {
+    append(embedding);
+    insert(size() - 1);
+}
+
+void HNSWIndex::add(const std::vector<FaceNetEmbed>& embeddings) {
+    if (embeddings.empty())
+        return;
+
+    // Storage is grown up front, the threads only change the links
+    size_t begin = size();
+    data_.reserve(data_.size() + embeddings.size() * EMBEDDING_DIMS);
+    for (size_t i = 0; i < embeddings.size(); i++)
+        append(embeddings[i]);
+
+    if (begin == 0)
+        insert(begin++);
+    parallel_for(size() - begin, threads_, [&](size_t i) {
+        insert(begin + i);
+    });
+}
+
+std::vector<Neighbor> HNSWIndex::search_layer(const float* query, NodeId entry, size_t ef, int level) const {
+    visited.reset(size());
+    visited.visit(entry);
+
+    // Candidates to expand in a min heap, the ef closest nodes in a max heap
+    std::vector<Neighbor> candidates(1, Neighbor(entry, distance(query, entry)));
+    std::vector<Neighbor> results = candidates;
+    std::vector<NodeId> next;
+
+    while (!candidates.empty()) {
+        Neighbor c = candidates.front();
+        if (results.size() >= ef && results.front() < c)
+            break;
+        std::pop_heap(candidates.begin(), candidates.end(), farther);
+        candidates.pop_back();
+
+        next.clear();
+        {
+            std::lock_guard<std::mutex> lock(locks_[c.id]);
+            const std::vector<NodeId>& links = links_[c.id][level];
+            for (size_t i = 0; i < links.size(); i++) {
+                if (visited.visit(links[i]))
+                    next.push_back(links[i]);
+            }
+        }
+
+        for (size_t i = 0; i < next.size(); i++) {
+            Neighbor n(next[i], distance(query, next[i]));
+            if (results.size() < ef || n < results.front()) {
+                candidates.push_back(n);
+                std::push_heap(candidates.begin(), candidates.end(), farther);
+                results.push_back(n);
+                std::push_heap(results.begin(), results.end());
+                if (results.size() > ef) {
+                    std::pop_heap(results.begin(), results.end());
+                    results.pop_back();
+                }
+            }
+        }
+    }
+
+    std::sort_heap(results.begin(), results.end());
+    return results;
+}
+
+std::vector<HNSWIndex::NodeId> HNSWIndex::select_neighbors(std::vector<Neighbor> candidates, size_t m) const {
+    std::sort(candidates.begin(), candidates.end());
+
+    // Skip candidates that are closer to an already selected neighbour than
+    // to the node, they are reachable through that neighbour
+    std::vector<NodeId> selected;
+    for (size_t i = 0; i < candidates.size() && selected.size() < m; i++) {
+        const float* c = data_.data() + candidates[i].id * EMBEDDING_DIMS;
+        bool keep = true;
+        for (size_t j = 0; j < selected.size() && keep; j++)
+            keep = distance(c, selected[j]) >= candidates[i].distance;
+        if (keep)
+            selected.push_back(candidates[i].id);
+    }
+    return selected;
+}
+
+void HNSWIndex::link(NodeId id, int level, const std::vector<NodeId>& others) {
+    std::vector<NodeId>& links = links_[id][level];
+    for (size_t i = 0; i < others.size(); i++) {
+        if (std::find(links.begin(), links.end(), others[i]) == links.end())
+            links.push_back(others[i]);
+    }
+    if (links.size() <= max_links(level))
+        return;
+
+    const float* node = data_.data() + id * EMBEDDING_DIMS;
+    std::vector<Neighbor> candidates;
+    for (size_t i = 0; i < links.size(); i++)
+        candidates.push_back(Neighbor(links[i], distance(node, links[i])));
+    links = select_neighbors(candidates, max_links(level));
+}
+
+void HNSWIndex::insert(NodeId id) {
+    const float* query = data_.data() + id * EMBEDDING_DIMS;
+    const int level = levels_[id];
+
+    NodeId entry;
+    int max_level;
+    {
+        std::lock_guard<std::mutex> lock(entry_mutex_);
+        if (max_level_ < 0) {
+            entry_ = id;
+            max_level_ = level;
+            return;
+        }
+        entry = entry_;
+        max_level = max_level_;
+    }
+
+    // Greedy descent through the layers above the node
+    for (int l = max_level; l > level; l--)
+        entry = search_layer(query, entry, 1, l)[0].id;
+
+    for (int l = std::min(level, max_level); l >= 0; l--) {
+        std::vector<Neighbor> candidates = search_layer(query, entry, ef_construction_, l);
+        std::vector<NodeId> neighbors = select_neighbors(candidates, M_);
+        {
+            std::lock_guard<std::mutex> lock(locks_[id]);
+            link(id, l, neighbors);
+        }
+        for (size_t i = 0; i < neighbors.size(); i++) {
+            std::lock_guard<std::mutex> lock(locks_[neighbors[i]]);
+            link(neighbors[i], l, std::vector<NodeId>(1, id));
+        }
+        entry = candidates[0].id;
+    }
+
+    std::lock_guard<std::mutex> lock(entry_mutex_);
+    if (level > max_level_) {
+        entry_ = id;
+        max_level_ = level;
+    }
+}
+
+std::vector<Neighbor> HNSWIndex::search(const FaceNetEmbed& query, size_t k) const {
+    NodeId entry;
+    int max_level;
+    {
+        std::lock_guard<std::mutex> lock(entry_mutex_);
+        entry = entry_;
+        max_level = max_level_;
+    }
+    if (max_level < 0 || k == 0)
+        return std::vector<Neighbor>();
+
+    const float* q = &query(0);
+    for (int l = max_level; l > 0; l--)
+        entry = search_layer(q, entry, 1, l)[0].id;
+
+    std::vector<Neighbor> out = search_layer(q, entry, std::max(ef_, k), 0);
+    if (out.size() > k)
+        out.resize(k);
+    return out;
+}
+
+void HNSWIndex::save(const std::string& path) const {
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file)
+        throw std::runtime_error(std::string("Directory does not exist: ")+path);
+
+    uint64_t header[] = {M_, ef_construction_, ef_, size()};
+    int32_t top[] = {max_level_, (int32_t)entry_};
+    file.write(HNSW_MAGIC, sizeof(HNSW_MAGIC));
+    file.write((const char*)header, sizeof(header));
+    file.write((const char*)top, sizeof(top));
+    file.write((const char*)data_.data(), data_.size() * sizeof(float));
+    for (size_t i = 0; i < size(); i++) {
+        int32_t level = levels_[i];
+        file.write((const char*)&level, sizeof(level));
+        for (int l = 0; l <= level; l++) {
+            uint32_t n = links_[i][l].size();
+            file.write((const char*)&n, sizeof(n));
+            file.write((const char*)links_[i][l].data(), n * sizeof(NodeId));
+        }
+    }
+    if (!file)
+        throw std::runtime_error(std::string("Could not write index: ")+path);
+}
+
+void HNSWIndex::load(const std::string& path) {
+    std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!file)
+        throw std::runtime_error(std::string("No such file or directory: ")+path);
+    const size_t file_size = file.tellg();
+    file.seekg(0);
+    auto check = [&](bool valid) {
+        if (!valid)
+            throw std::runtime_error(std::string("Not a HNSW index: ")+path);
+    };
+    auto read = [&](void* dst, size_t bytes) {
+        // Sizes read from a corrupt file must not allocate more than the file holds
+        check(bytes <= file_size - (size_t)file.tellg());
+        check((bool)file.read((char*)dst, bytes));
+    };
+
+    char magic[sizeof(HNSW_MAGIC)];
+    read(magic, sizeof(magic));
+    check(memcmp(magic, HNSW_MAGIC, sizeof(magic)) == 0);
+
+    uint64_t header[4];
+    int32_t top[2];
+    read(header, sizeof(header));
+    read(top, sizeof(top));
+    const size_t M = header[0], n = header[3];
+    const int max_level = top[0];
+    const NodeId entry = top[1];
+    check(M >= 2 && header[1] > 0 && header[2] > 0);
+    check(n <= file_size / (EMBEDDING_DIMS * sizeof(float)));
+    check(n == 0 ? max_level == -1 : max_level >= 0 && entry < n);
+
+    // Read into temporaries, so the index is unchanged if the file is corrupt
+    std::vector<float, AlignedAllocator<float, 64> > data(n * EMBEDDING_DIMS);
+    read(data.data(), data.size() * sizeof(float));
+    std::vector<int> levels(n);
+    std::vector<std::vector<std::vector<NodeId> > > links(n);
+    for (size_t i = 0; i < n; i++) {
+        int32_t level;
+        read(&level, sizeof(level));
+        check(level >= 0 && level <= max_level);
+        levels[i] = level;
+        links[i].resize(level + 1);
+        for (int l = 0; l <= level; l++) {
+            uint32_t count;
+            read(&count, sizeof(count));
+            check(count <= (l == 0 ? 2 * M : M));
+            links[i][l].resize(count);
+            read(links[i][l].data(), count * sizeof(NodeId));
+        }
+    }
+
+    // Every link must lead to a node that exists on its layer
+    check(n == 0 || levels[entry] == max_level);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t l = 0; l < links[i].size(); l++) {
+            for (size_t j = 0; j < links[i][l].size(); j++)
+                check(links[i][l][j] < n && levels[links[i][l][j]] >= (int)l);
+        }
+    }
+
+    M_ = M;
+    ef_construction_ = header[1];
+    ef_ = header[2];
+    data_.swap(data);
+    levels_.swap(levels);
+    links_.swap(links);
+    locks_.clear();
+    for (size_t i = 0; i < n; i++)
+        locks_.emplace_back();
+    std::lock_guard<std::mutex> lock(entry_mutex_);
+    entry_ = entry;
+    max_level_ = max_level;
+}
@@ -1,8 +1,20 @@
 #include "learning/facerecognizer.hpp"
 
-FaceRecognizer::FaceRecognizer() {}
+#include <map>
+
+const std::string FaceRecognizer::UNKNOWN = "unknown";
+
+FaceRecognizer::FaceRecognizer() : neighbors_(5), max_distance_(0.99) {}
 
 void FaceRecognizer::train(std::vector<FaceNetEmbed> faces, std::vector<std::string> labels) {
+    if (index_) {
+        if (faces.size() != labels.size())
+            throw std::runtime_error("Number of faces and labels differ.");
+        index_->add(faces);
+        labels_.insert(labels_.end(), labels.begin(), labels.end());
+        return;
+    }
+
     ova_trainer trainer;
 
     dlib::svm_c_trainer<linear_kernel> linear_trainer;
@@ -11,12 +23,75 @@ void FaceRecognizer::train(std::vector<FaceNetEmbed> faces, std::vector<std::str
     trainer.set_trainer(probabilistic(linear_trainer, 3));
 
     df_ = trainer.train(faces, labels);
+    scorer_ = LinearScorer(df_);
 }
 
 std::pair<std::string, float> FaceRecognizer::recognize(FaceNetEmbed s) {
-    return df_.predict(s);
+    if (!index_)
+        return scorer_.predict(s);
+
+    std::vector<Neighbor> nbs = index_->search(s, neighbors_);
+
+    // Majority vote of the close neighbours. Labels are listed in the order
+    // of their nearest neighbour, so ties go to the label of the nearest one.
+    std::map<std::string, size_t> votes;
+    std::vector<std::string> order;
+    size_t voters = 0;
+    for (; voters < nbs.size() && nbs[voters].distance <= max_distance_; voters++) {
+        const std::string& label = labels_[nbs[voters].id];
+        if (votes[label]++ == 0)
+            order.push_back(label);
+    }
+
+    std::string best = UNKNOWN;
+    size_t most = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (votes[order[i]] > most) {
+            most = votes[order[i]];
+            best = order[i];
+        }
+    }
+    return std::make_pair(best, voters ? (float)most / voters : 0.f);
+}
+
+std::vector<std::pair<std::string, float> > FaceRecognizer::recognize(const std::vector<FaceNetEmbed>& faces) {
+    if (!index_)
+        return scorer_.predict(faces);
+
+    std::vector<std::pair<std::string, float> > out;
+    out.reserve(faces.size());
+    for (size_t i = 0; i < faces.size(); i++)
+        out.push_back(recognize(faces[i]));
+    return out;
+}
+
+void FaceRecognizer::set_index(std::shared_ptr<EmbeddingIndex> index, const std::vector<std::string>& labels) {
+    if ((index ? index->size() : 0) != labels.size())
+        throw std::runtime_error("Every embedding of the index needs a label.");
+    index_ = index;
+    labels_ = labels;
+}
+
+void FaceRecognizer::add(const FaceNetEmbed& face, const std::string& label) {
+    if (!index_)
+        throw std::runtime_error("Faces can only be added to a FaceRecognizer with an index.");
+    index_->add(face);
+    labels_.push_back(label);
+}
+
+void FaceRecognizer::set_neighbors(size_t k) {
+    if (k == 0)
+        throw std::runtime_error("Number of neighbors must be positive.");
+    neighbors_ = k;
+}
+
+void FaceRecognizer::set_max_distance(float distance) {
+    if (distance <= 0)
+        throw std::runtime_error("Maximum distance must be positive.");
+    max_distance_ = distance;
 }
 
 void FaceRecognizer::load(const std::string& path) {
     dlib::deserialize(path) >> df_;
+    scorer_ = LinearScorer(df_);
 }
@@ -0,0 +1,98 @@
+#include "learning/identitytracker.hpp"
+
+#include <cmath>
+
+IdentityTracker::IdentityTracker(OpenFace& of, FaceRecognizer& fr, int reembed_interval,
+                                 double max_change, double decay)
+    : of_(of), fr_(fr), max_change_(max_change), decay_(decay), embeddings_(0) {
+    set_reembed_interval(reembed_interval);
+    if (decay < 0 || decay >= 1)
+        throw std::runtime_error("Decay must be in [0, 1).");
+}
+
+void IdentityTracker::set_reembed_interval(int interval) {
+    if (interval <= 0)
+        throw std::runtime_error("Reembed interval must be positive.");
+    reembed_interval_ = interval;
+}
+
+cv::Mat IdentityTracker::thumbnail(const Detection& d) {
+    cv::Mat frame = d.face.asConstCVImage().getMat(cv::ACCESS_READ);
+    cv::Rect roi = d.rect.asCVRect() & cv::Rect(0, 0, frame.cols, frame.rows);
+    cv::Mat small, gray;
+    if (roi.area() == 0)
+        return cv::Mat::zeros(THUMBNAIL_SIZE, THUMBNAIL_SIZE, CV_8U);
+    cv::resize(frame(roi), small, cv::Size(THUMBNAIL_SIZE, THUMBNAIL_SIZE), 0, 0, cv::INTER_AREA);
+    cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+    return gray;
+}
+
+void IdentityTracker::fuse(State& s, const std::pair<std::string, float>& prediction) {
+    for (auto it = s.scores.begin(); it != s.scores.end(); ++it)
+        it->second *= decay_;
+    s.scores[prediction.first] += (1 - decay_) * prediction.second;
+    s.predictions++;
+}
+
+std::vector<Identity> IdentityTracker::update(const std::vector<Track>& tracks) {
+    std::map<int, State> states;
+    std::vector<Detection> pending;
+    std::vector<size_t> pending_tracks;
+    std::vector<cv::Mat> thumbnails(tracks.size());
+
+    for (size_t i = 0; i < tracks.size(); i++) {
+        auto it = states_.find(tracks[i].id);
+        State& s = states[tracks[i].id];
+        if (it != states_.end())
+            s = it->second;
+        else {
+            s.predictions = 0;
+            s.frames_since_embedding = 0;
+        }
+
+        thumbnails[i] = thumbnail(tracks[i].detection);
+        bool embed = s.predictions == 0 || ++s.frames_since_embedding >= reembed_interval_
+            || cv::norm(thumbnails[i], s.thumbnail, cv::NORM_L1) / thumbnails[i].total() > 255 * max_change_;
+        if (embed) {
+            pending.push_back(tracks[i].detection);
+            pending_tracks.push_back(i);
+        }
+    }
+    states_.swap(states);
+
+    std::vector<FaceNetEmbed> reps;
+    if (!pending.empty())
+        reps = of_.facenet(pending);
+    embeddings_ += reps.size();
+
+    std::vector<Identity> out(tracks.size());
+    for (size_t i = 0; i < tracks.size(); i++) {
+        out[i].id = tracks[i].id;
+        out[i].detection = tracks[i].detection;
+        out[i].embedded = false;
+    }
+    for (size_t j = 0; j < pending_tracks.size(); j++) {
+        size_t i = pending_tracks[j];
+        State& s = states_[tracks[i].id];
+        fuse(s, fr_.recognize(reps[j]));
+        s.thumbnail = thumbnails[i];
+        s.frames_since_embedding = 0;
+        out[i].embedded = true;
+    }
+
+    for (size_t i = 0; i < tracks.size(); i++) {
+        const State& s = states_[tracks[i].id];
+        // Normalize by the total weight of the predictions made so far
+        float weight = 1 - std::pow(decay_, s.predictions);
+        float best = -1;
+        for (auto it = s.scores.begin(); it != s.scores.end(); ++it) {
+            if (it->second > best) {
+                best = it->second;
+                out[i].label = it->first;
+            }
+        }
+        out[i].probability = weight > 0 ? best / weight : 0;
+    }
+
+    return out;
+}
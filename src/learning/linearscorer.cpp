@@ -0,0 +1,92 @@
+#include "learning/linearscorer.hpp"
+#include "learning/distance.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+// std::min takes references, so the constant needs a definition
+const size_t LinearScorer::BLOCK;
+
+LinearScorer::LinearScorer(const ova_decision_function& df) {
+    const ova_decision_function::binary_function_table& dfs = df.get_binary_decision_functions();
+    W_.set_size(dfs.size(), FaceNetEmbed::NR);
+    b_.reserve(dfs.size());
+    alpha_.reserve(dfs.size());
+    beta_.reserve(dfs.size());
+    labels_.reserve(dfs.size());
+
+    // The table is a map, so this is the order in which predict() compares the classes
+    size_t c = 0;
+    for (ova_decision_function::binary_function_table::const_iterator i = dfs.begin(); i != dfs.end(); ++i, ++c) {
+        if (!i->second.contains<linear_probabilistic_function>())
+            throw std::runtime_error("Only linear decision functions can be compiled.");
+        const linear_probabilistic_function& pf = i->second.cast_to<linear_probabilistic_function>();
+        const dlib::decision_function<linear_kernel>& f = pf.decision_funct;
+
+        dlib::matrix<double, 0, 1> w = dlib::zeros_matrix<double>(FaceNetEmbed::NR, 1);
+        for (long j = 0; j < f.basis_vectors.size(); j++)
+            w += (double)f.alpha(j) * dlib::matrix_cast<double>(f.basis_vectors(j));
+        dlib::set_rowm(W_, c) = dlib::trans(dlib::matrix_cast<float>(w));
+
+        b_.push_back(f.b);
+        alpha_.push_back(pf.alpha);
+        beta_.push_back(pf.beta);
+        labels_.push_back(i->first);
+    }
+}
+
+std::pair<size_t, float> LinearScorer::classify(const FaceNetEmbed& face) const {
+    if (classes() == 0)
+        throw std::runtime_error("Decision function has no classes.");
+
+    float scores[BLOCK];
+    std::pair<size_t, float> best(0, -std::numeric_limits<float>::infinity());
+    for (size_t c = 0; c < classes(); c += BLOCK) {
+        const size_t n = std::min(BLOCK, classes() - c);
+        dot_products(&face(0), weights(c), n, FaceNetEmbed::NR, scores);
+        for (size_t i = 0; i < n; i++) {
+            const float p = 1 / (1 + std::exp(alpha_[c + i] * (scores[i] - b_[c + i]) + beta_[c + i]));
+            if (p > best.second)
+                best = std::make_pair(c + i, p);
+        }
+    }
+    return best;
+}
+
+std::vector<std::pair<size_t, float> > LinearScorer::classify(const std::vector<FaceNetEmbed>& faces) const {
+    if (classes() == 0)
+        throw std::runtime_error("Decision function has no classes.");
+    if (faces.empty())
+        return std::vector<std::pair<size_t, float> >();
+
+    dlib::matrix<float> X(faces.size(), FaceNetEmbed::NR);
+    for (size_t i = 0; i < faces.size(); i++)
+        dlib::set_rowm(X, i) = dlib::trans(faces[i]);
+    const dlib::matrix<float> scores = X * dlib::trans(W_);
+
+    std::vector<std::pair<size_t, float> > out(faces.size(), std::pair<size_t, float>(0, -std::numeric_limits<float>::infinity()));
+    for (size_t i = 0; i < faces.size(); i++) {
+        for (size_t c = 0; c < classes(); c++) {
+            const float p = 1 / (1 + std::exp(alpha_[c] * (scores(i, c) - b_[c]) + beta_[c]));
+            if (p > out[i].second)
+                out[i] = std::make_pair(c, p);
+        }
+    }
+    return out;
+}
+
+std::pair<std::string, float> LinearScorer::predict(const FaceNetEmbed& face) const {
+    std::pair<size_t, float> best = classify(face);
+    return std::make_pair(labels_[best.first], best.second);
+}
+
+std::vector<std::pair<std::string, float> > LinearScorer::predict(const std::vector<FaceNetEmbed>& faces) const {
+    std::vector<std::pair<size_t, float> > best = classify(faces);
+    std::vector<std::pair<std::string, float> > out;
+    out.reserve(best.size());
+    for (size_t i = 0; i < best.size(); i++)
+        out.push_back(std::make_pair(labels_[best[i].first], best[i].second));
+    return out;
+}
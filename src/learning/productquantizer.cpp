@@ -0,0 +1,336 @@
+#include "learning/productquantizer.hpp"
+#include "learning/distance.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+const char PQ_MAGIC[] = "OFPQ1";
+const char PQ_INDEX_MAGIC[] = "OFPQI1";
+
+/**
+ * Smallest number of codes scanned by one thread.
+ */
+const size_t MIN_SHARD_SIZE = 16384;
+
+/**
+ * Pushes #nb into the max heap of the #k nearest neighbours.
+ */
+inline void push_nearest(std::vector<Neighbor>& heap, const Neighbor& nb, size_t k) {
+    if (heap.size() < k) {
+        heap.push_back(nb);
+        std::push_heap(heap.begin(), heap.end());
+    }
+    else if (nb < heap.front()) {
+        std::pop_heap(heap.begin(), heap.end());
+        heap.back() = nb;
+        std::push_heap(heap.begin(), heap.end());
+    }
+}
+
+}
+
+ProductQuantizer::ProductQuantizer(size_t subspaces) : subspaces_(subspaces) {
+    if (subspaces == 0 || EMBEDDING_DIMS % subspaces != 0)
+        throw std::runtime_error("Number of subspaces must divide the embedding size.");
+    dims_ = EMBEDDING_DIMS / subspaces;
+}
+
+void ProductQuantizer::train(const std::vector<FaceNetEmbed>& samples, int iterations, unsigned long seed) {
+    const size_t n = samples.size();
+    if (n < CENTROIDS)
+        throw std::runtime_error("Product quantizer needs at least 256 training embeddings.");
+
+    std::vector<float> centroids(subspaces_ * CENTROIDS * dims_);
+    parallel_for(subspaces_, std::max(1u, std::thread::hardware_concurrency()), [&](size_t j) {
+        // Contiguous copy of the subspace, so distances are computed row by row
+        std::vector<float> data(n * dims_);
+        for (size_t i = 0; i < n; i++)
+            std::copy(&samples[i](j * dims_), &samples[i](j * dims_) + dims_, data.begin() + i * dims_);
+
+        std::mt19937 rng(seed + j);
+        std::vector<size_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), rng);
+
+        float* c = centroids.data() + j * CENTROIDS * dims_;
+        for (size_t k = 0; k < CENTROIDS; k++)
+            std::copy(data.begin() + order[k] * dims_, data.begin() + (order[k] + 1) * dims_, c + k * dims_);
+
+        std::vector<uint8_t> assignment(n);
+        std::vector<float> distances(CENTROIDS);
+        std::vector<float> sums(CENTROIDS * dims_);
+        std::vector<size_t> counts(CENTROIDS);
+        for (int it = 0; it < iterations; it++) {
+            for (size_t i = 0; i < n; i++) {
+                squared_distances(&data[i * dims_], c, CENTROIDS, dims_, distances.data());
+                assignment[i] = std::min_element(distances.begin(), distances.end()) - distances.begin();
+            }
+
+            std::fill(sums.begin(), sums.end(), 0.f);
+            std::fill(counts.begin(), counts.end(), 0);
+            for (size_t i = 0; i < n; i++) {
+                float* sum = &sums[assignment[i] * dims_];
+                for (size_t d = 0; d < dims_; d++)
+                    sum[d] += data[i * dims_ + d];
+                counts[assignment[i]]++;
+            }
+            for (size_t k = 0; k < CENTROIDS; k++) {
+                if (counts[k] == 0) {
+                    // Empty clusters restart at a random sample
+                    size_t i = rng() % n;
+                    std::copy(data.begin() + i * dims_, data.begin() + (i + 1) * dims_, c + k * dims_);
+                    continue;
+                }
+                for (size_t d = 0; d < dims_; d++)
+                    c[k * dims_ + d] = sums[k * dims_ + d] / counts[k];
+            }
+        }
+    });
+    centroids_.swap(centroids);
+}
+
+void ProductQuantizer::train(FaceNetEmbedDatabase& db, size_t max_samples, int iterations) {
+    std::vector<FaceNetEmbed> samples;
+    for (int i = 0; i < db.batches() && samples.size() < max_samples; i++) {
+        Batch<FaceNetEmbed> batch = db.batch(i);
+        size_t count = std::min(batch.samples.size(), max_samples - samples.size());
+        samples.insert(samples.end(), batch.samples.begin(), batch.samples.begin() + count);
+    }
+    train(samples, iterations);
+}
+
+void ProductQuantizer::encode(const FaceNetEmbed& embedding, uint8_t* code) const {
+    if (!trained())
+        throw std::runtime_error("Product quantizer is not trained.");
+    float distances[CENTROIDS];
+    for (size_t j = 0; j < subspaces_; j++) {
+        squared_distances(&embedding(j * dims_), &centroids_[j * CENTROIDS * dims_], CENTROIDS, dims_, distances);
+        code[j] = std::min_element(distances, distances + CENTROIDS) - distances;
+    }
+}
+
+FaceNetEmbed ProductQuantizer::decode(const uint8_t* code) const {
+    if (!trained())
+        throw std::runtime_error("Product quantizer is not trained.");
+    FaceNetEmbed out;
+    for (size_t j = 0; j < subspaces_; j++) {
+        const float* c = &centroids_[(j * CENTROIDS + code[j]) * dims_];
+        std::copy(c, c + dims_, &out(j * dims_));
+    }
+    return out;
+}
+
+void ProductQuantizer::distance_table(const FaceNetEmbed& query, float* table) const {
+    if (!trained())
+        throw std::runtime_error("Product quantizer is not trained.");
+    for (size_t j = 0; j < subspaces_; j++)
+        squared_distances(&query(j * dims_), &centroids_[j * CENTROIDS * dims_], CENTROIDS, dims_, table + j * CENTROIDS);
+}
+
+void ProductQuantizer::save(const std::string& path) const {
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file)
+        throw std::runtime_error(std::string("Directory does not exist: ")+path);
+    if (!save(file))
+        throw std::runtime_error(std::string("Could not write quantizer: ")+path);
+}
+
+bool ProductQuantizer::save(std::ostream& out) const {
+    uint64_t subspaces = subspaces_;
+    out.write(PQ_MAGIC, sizeof(PQ_MAGIC));
+    out.write((const char*)&subspaces, sizeof(subspaces));
+    out.write((const char*)centroids_.data(), centroids_.size() * sizeof(float));
+    return (bool)out;
+}
+
+void ProductQuantizer::load(const std::string& path) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+        throw std::runtime_error(std::string("No such file or directory: ")+path);
+    if (!load(file))
+        throw std::runtime_error(std::string("Not a product quantizer: ")+path);
+}
+
+bool ProductQuantizer::load(std::istream& in) {
+    char magic[sizeof(PQ_MAGIC)];
+    uint64_t subspaces;
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, PQ_MAGIC, sizeof(magic)) != 0 ||
+        !in.read((char*)&subspaces, sizeof(subspaces)) || subspaces == 0 || EMBEDDING_DIMS % subspaces != 0)
+        return false;
+
+    std::vector<float> centroids(subspaces * CENTROIDS * (EMBEDDING_DIMS / subspaces));
+    if (!in.read((char*)centroids.data(), centroids.size() * sizeof(float)))
+        return false;
+
+    subspaces_ = subspaces;
+    dims_ = EMBEDDING_DIMS / subspaces;
+    centroids_.swap(centroids);
+    return true;
+}
+
+PQIndex::PQIndex(const ProductQuantizer& pq, const std::string& vectors_path)
+    : pq_(pq), unflushed_(false), rerank_(16), threads_(std::max(1u, std::thread::hardware_concurrency())) {
+    if (!pq.trained())
+        throw std::runtime_error("Product quantizer is not trained.");
+    if (!vectors_path.empty())
+        open_vectors(vectors_path, true);
+}
+
+PQIndex::PQIndex(const std::string& index_path, const std::string& vectors_path)
+    : unflushed_(false), rerank_(16), threads_(std::max(1u, std::thread::hardware_concurrency())) {
+    load(index_path);
+    if (!vectors_path.empty())
+        open_vectors(vectors_path, false);
+}
+
+void PQIndex::open_vectors(const std::string& path, bool replace) {
+    vectors_path_ = path;
+    writer_.open(path.c_str(), std::ios::binary | (replace ? std::ios::trunc : std::ios::app));
+    if (!writer_)
+        throw std::runtime_error(std::string("Directory does not exist: ")+path);
+    reader_.open(path.c_str(), std::ios::binary);
+    if (!replace && stored_vectors() != size())
+        throw std::runtime_error(std::string("Vector file does not match the index: ")+path);
+}
+
+size_t PQIndex::stored_vectors() const {
+    std::lock_guard<std::mutex> lock(reader_mutex_);
+    writer_.flush();
+    unflushed_ = false;
+    reader_.clear();
+    reader_.seekg(0, std::ios::end);
+    return (size_t)reader_.tellg() / (EMBEDDING_DIMS * sizeof(float));
+}
+
+void PQIndex::save(const std::string& path) const {
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file)
+        throw std::runtime_error(std::string("Directory does not exist: ")+path);
+
+    uint64_t n = size();
+    file.write(PQ_INDEX_MAGIC, sizeof(PQ_INDEX_MAGIC));
+    pq_.save(file);
+    file.write((const char*)&n, sizeof(n));
+    file.write((const char*)codes_.data(), codes_.size());
+    if (!file)
+        throw std::runtime_error(std::string("Could not write index: ")+path);
+}
+
+void PQIndex::load(const std::string& path) {
+    std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!file)
+        throw std::runtime_error(std::string("No such file or directory: ")+path);
+    const size_t file_size = file.tellg();
+    file.seekg(0);
+
+    char magic[sizeof(PQ_INDEX_MAGIC)];
+    ProductQuantizer pq;
+    uint64_t n;
+    if (!file.read(magic, sizeof(magic)) || memcmp(magic, PQ_INDEX_MAGIC, sizeof(magic)) != 0 ||
+        !pq.load(file) || !file.read((char*)&n, sizeof(n)) ||
+        n > (file_size - (size_t)file.tellg()) / pq.subspaces())
+        throw std::runtime_error(std::string("Not a PQ index: ")+path);
+
+    std::vector<uint8_t> codes(n * pq.subspaces());
+    if (!file.read((char*)codes.data(), codes.size()))
+        throw std::runtime_error(std::string("Not a PQ index: ")+path);
+    if (reader_.is_open() && stored_vectors() != n)
+        throw std::runtime_error(std::string("Vector file does not match the index: ")+vectors_path_);
+
+    pq_ = pq;
+    codes_.swap(codes);
+}
+
+void PQIndex::add(const FaceNetEmbed& embedding) {
+    const size_t m = pq_.subspaces();
+    codes_.resize(codes_.size() + m);
+    pq_.encode(embedding, &codes_[codes_.size() - m]);
+
+    if (writer_.is_open()) {
+        std::lock_guard<std::mutex> lock(reader_mutex_);
+        writer_.write((const char*)&embedding(0), EMBEDDING_DIMS * sizeof(float));
+        if (!writer_)
+            throw std::runtime_error(std::string("Could not write embeddings: ")+vectors_path_);
+        unflushed_ = true;
+    }
+}
+
+void PQIndex::set_rerank(size_t factor) {
+    if (factor == 0)
+        throw std::runtime_error("Rerank factor must be positive.");
+    rerank_ = factor;
+}
+
+void PQIndex::set_threads(int threads) {
+    if (threads <= 0)
+        throw std::runtime_error("Number of threads must be positive.");
+    threads_ = threads;
+}
+
+std::vector<Neighbor> PQIndex::scan(const FaceNetEmbed& query, size_t k) const {
+    const size_t n = size();
+    const size_t m = pq_.subspaces();
+    k = std::min(k, n);
+    if (k == 0)
+        return std::vector<Neighbor>();
+
+    std::vector<float> table(m * ProductQuantizer::CENTROIDS);
+    pq_.distance_table(query, table.data());
+
+    const size_t shards = std::max<size_t>(1, std::min<size_t>(threads_, n / MIN_SHARD_SIZE));
+    const size_t shard_size = (n + shards - 1) / shards;
+    std::vector<std::vector<Neighbor> > heaps(shards);
+    parallel_for(shards, shards, [&](size_t s) {
+        const size_t end = std::min(n, (s + 1) * shard_size);
+        std::vector<Neighbor>& heap = heaps[s];
+        heap.reserve(k + 1);
+        for (size_t i = s * shard_size; i < end; i++)
+            push_nearest(heap, Neighbor(i, pq_.distance(table.data(), &codes_[i * m])), k);
+    });
+
+    std::vector<Neighbor> out;
+    for (size_t s = 0; s < shards; s++)
+        out.insert(out.end(), heaps[s].begin(), heaps[s].end());
+    std::partial_sort(out.begin(), out.begin() + k, out.end());
+    out.resize(k);
+    return out;
+}
+
+std::vector<Neighbor> PQIndex::search(const FaceNetEmbed& query, size_t k) const {
+    if (!reader_.is_open() || rerank_ == 1)
+        return scan(query, k);
+
+    std::vector<Neighbor> candidates = scan(query, k * rerank_);
+    std::vector<float> rows(candidates.size() * EMBEDDING_DIMS);
+    {
+        std::lock_guard<std::mutex> lock(reader_mutex_);
+        if (unflushed_) {
+            writer_.flush();
+            unflushed_ = false;
+        }
+        // Reading in file order turns the seeks into mostly forward skips
+        std::vector<size_t> order(candidates.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return candidates[a].id < candidates[b].id;
+        });
+        for (size_t i = 0; i < order.size(); i++) {
+            reader_.clear();
+            reader_.seekg(candidates[order[i]].id * EMBEDDING_DIMS * sizeof(float));
+            if (!reader_.read((char*)&rows[order[i] * EMBEDDING_DIMS], EMBEDDING_DIMS * sizeof(float)))
+                throw std::runtime_error(std::string("Could not read embeddings: ")+vectors_path_);
+        }
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++)
+        squared_distances(&query(0), &rows[i * EMBEDDING_DIMS], 1, EMBEDDING_DIMS, &candidates[i].distance);
+    std::sort(candidates.begin(), candidates.end());
+    if (candidates.size() > k)
+        candidates.resize(k);
+    return candidates;
+}
@@ -0,0 +1,122 @@
+-- Converts a serialized torch network (e.g. nn4.v2.t7) to the weight file
+-- format read by NativeNetwork, so the network can be run without the torch
+-- runtime.
+--
+-- Usage: th src/openface/convert_nn.lua resources/nn4.v2.t7 resources/nn4.v2.ofnn
+
+require 'torch'
+require 'nn'
+require 'dpnn'
+
+torch.setdefaulttensortype('torch.FloatTensor')
+
+-- Must match the layer types in src/openface/nativenetwork.cpp
+local MAGIC = 0x4E4E464F -- "OFNN"
+local VERSION = 1
+local SEQUENTIAL, CONCAT, CONV, BATCHNORM, RELU, MAXPOOL, AVGPOOL, LRN,
+      LINEAR, NORMALIZE, RESHAPE, SQUARE, SQRT, MULCONSTANT, POWER, IDENTITY =
+      1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+
+local function writeInts(f, ...)
+    for _, v in ipairs({...}) do
+        f:writeInt(v)
+    end
+end
+
+-- Writes the elements of #t only, a clone owns a storage of exactly their size
+-- even if #t is a view into a larger one, e.g. after getParameters()
+local function writeTensor(f, t)
+    f:writeFloat(t:float():clone():storage())
+end
+
+local function write(f, m)
+    local name = torch.typename(m)
+
+    if name == 'nn.SpatialConvolution' or name == 'nn.SpatialConvolutionMM' then
+        writeInts(f, CONV, m.nInputPlane, m.nOutputPlane, m.kW, m.kH, m.dW, m.dH, m.padW or 0, m.padH or 0)
+        writeTensor(f, m.weight)
+        writeTensor(f, m.bias)
+    elseif name == 'nn.SpatialBatchNormalization' or name == 'nn.BatchNormalization' then
+        -- Store y = scale * x + shift, older nn versions keep running_std = 1/std
+        local invstd
+        if m.running_var then
+            invstd = torch.add(m.running_var:float(), m.eps):sqrt():pow(-1)
+        else
+            invstd = m.running_std:float()
+        end
+        local scale = m.weight and torch.cmul(m.weight:float(), invstd) or invstd
+        local shift = torch.cmul(m.running_mean:float(), scale):mul(-1)
+        if m.bias then
+            shift:add(m.bias:float())
+        end
+        writeInts(f, BATCHNORM, scale:nElement())
+        writeTensor(f, scale)
+        writeTensor(f, shift)
+    elseif name == 'nn.ReLU' then
+        writeInts(f, RELU)
+    elseif name == 'nn.SpatialMaxPooling' then
+        writeInts(f, MAXPOOL, m.kW, m.kH, m.dW, m.dH, m.padW or 0, m.padH or 0, m.ceil_mode and 1 or 0)
+    elseif name == 'nn.SpatialAveragePooling' then
+        local count_include_pad = m.count_include_pad == nil or m.count_include_pad
+        writeInts(f, AVGPOOL, m.kW, m.kH, m.dW, m.dH, m.padW or 0, m.padH or 0,
+                  m.ceil_mode and 1 or 0, count_include_pad and 1 or 0)
+    elseif name == 'nn.SpatialCrossMapLRN' then
+        writeInts(f, LRN, m.size)
+        f:writeFloat(m.alpha)
+        f:writeFloat(m.beta)
+        f:writeFloat(m.k)
+    elseif name == 'nn.Linear' then
+        writeInts(f, LINEAR, m.weight:size(2), m.weight:size(1))
+        writeTensor(f, m.weight)
+        writeTensor(f, m.bias)
+    elseif name == 'nn.Normalize' then
+        assert(m.p == 2, 'Only L2 normalization is supported')
+        writeInts(f, NORMALIZE)
+        f:writeFloat(m.eps)
+    elseif name == 'nn.View' or name == 'nn.Reshape' then
+        writeInts(f, RESHAPE)
+    elseif name == 'nn.Square' then
+        writeInts(f, SQUARE)
+    elseif name == 'nn.Sqrt' then
+        writeInts(f, SQRT)
+        f:writeFloat(m.eps or 0)
+    elseif name == 'nn.MulConstant' then
+        writeInts(f, MULCONSTANT)
+        f:writeFloat(m.constant_scalar)
+    elseif name == 'nn.Power' then
+        writeInts(f, POWER)
+        f:writeFloat(m.pow)
+    elseif name == 'nn.Dropout' or name == 'nn.Identity' then
+        writeInts(f, IDENTITY)
+    elseif name == 'nn.DepthConcat' or name == 'nn.Concat' then
+        assert(m.dimension == 2, 'Only concatenation along the feature dimension is supported')
+        writeInts(f, CONCAT, #m.modules)
+        for _, child in ipairs(m.modules) do
+            write(f, child)
+        end
+    elseif m.modules then
+        -- nn.Sequential, nn.SpatialLPPooling and decorators like nn.Inception
+        writeInts(f, SEQUENTIAL, #m.modules)
+        for _, child in ipairs(m.modules) do
+            write(f, child)
+        end
+    else
+        error('Unsupported module: ' .. name)
+    end
+end
+
+local input, output = arg[1], arg[2]
+assert(input and output, 'Usage: th convert_nn.lua <network.t7> <network.ofnn>')
+
+local net = torch.load(input)
+net:evaluate()
+net:float()
+
+local f = torch.DiskFile(output, 'w')
+f:binary()
+f:littleEndianEncoding()
+writeInts(f, MAGIC, VERSION)
+write(f, net)
+f:close()
+
+print('Converted ' .. input .. ' to ' .. output)
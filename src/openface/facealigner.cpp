@@ -1,13 +1,32 @@
 #include "openface/facealigner.hpp"
 #include "openface/settings.hpp"
+#include "core/support.hpp"
 
-FaceAligner::FaceAligner(const std::string& shape_path) {
+FaceAligner::FaceAligner(const std::string& shape_path)
+    : threads_(std::max(1u, std::thread::hardware_concurrency())) {
     load(shape_path);
 }
 
+void FaceAligner::set_threads(int threads) {
+    if (threads <= 0)
+        throw std::runtime_error("Number of threads must be positive.");
+    threads_ = threads;
+}
+
 void FaceAligner::load(const std::string& shape_path) {
     dlib::deserialize(shape_path) >> pose_model;
 
+    // Outer eye corners and nose of the 68 and of the 5 point annotation
+    if (pose_model.num_parts() == 68) {
+        landmarks_[0] = 36; landmarks_[1] = 45; landmarks_[2] = 33;
+    }
+    else if (pose_model.num_parts() == 5) {
+        landmarks_[0] = 2; landmarks_[1] = 0; landmarks_[2] = 4;
+    }
+    else {
+        throw std::runtime_error(std::string("Shape predictor has to have 68 or 5 parts: ")+shape_path);
+    }
+
     initialized_ = true;
 }
 
@@ -16,23 +35,96 @@ dlib::full_object_detection FaceAligner::predict(const Detection& d) const {
 }
 
 void FaceAligner::align(std::vector<Detection>& ds) const {
-    for (size_t i = 0; i < ds.size(); i++) {
+    parallel_for(ds.size(), threads_, [&](size_t i) {
         align(ds[i]);
-    }
+    });
+}
+
+void FaceAligner::align(const std::vector<Detection>& ds, float* data) const {
+    align(ds.data(), ds.size(), data);
+}
+
+void FaceAligner::align(const Detection* ds, size_t n, float* data) const {
+    const size_t face_size = 3 * FACE_SIZE_CONSTRAINT * FACE_SIZE_CONSTRAINT;
+    parallel_for(n, threads_, [&](size_t i) {
+        align(ds[i], data + i * face_size);
+    });
+}
+
+cv::Mat FaceAligner::transformation(const Detection& d) const {
+    // Find the pose of the face.
+    return transformation(predict(d));
+}
+
+cv::Mat FaceAligner::transformation(const PreparedImage& img, const Detection& d) const {
+    return transformation(pose_model(img.gray(), d.rect.asDLIBRect()));
+}
+
+cv::Mat FaceAligner::transformation(const dlib::full_object_detection& shape) const {
+    cv::Point2f landmarks[3];
+    for (int i = 0; i < 3; i++)
+        landmarks[i] = cv::Point2f(shape.part(landmarks_[i]).x(), shape.part(landmarks_[i]).y());
+    return cv::getAffineTransform(landmarks, OUTER_EYES_AND_NOSE);
 }
 
 void FaceAligner::align(Detection& d) const {
-    // Find the pose of each face.
-    dlib::full_object_detection shape = predict(d);
-
-    cv::Point2f landmarks[] = {
-        cv::Point2f(shape.part(36).x(), shape.part(36).y()),
-        cv::Point2f(shape.part(45).x(), shape.part(45).y()),
-        cv::Point2f(shape.part(33).x(), shape.part(33).y()),
-    };
-    cv::Mat H = cv::getAffineTransform(landmarks, OUTER_EYES_AND_NOSE);
+    cv::Mat H = transformation(d);
     d.face.warpAffine(H, cv::Size(FACE_SIZE_CONSTRAINT, FACE_SIZE_CONSTRAINT));
 
     // private access because Aligner is friend class of Face
     // face.align();
 }
+
+void FaceAligner::align(const Detection& d, float* data) const {
+    ConstCVImage frame = d.face.asConstCVImage();
+    sample(frame.getMat(cv::ACCESS_READ), transformation(d), data);
+}
+
+void FaceAligner::align(const PreparedImage& img, const Detection& d, float* data) const {
+    ConstCVImage frame = img.image().asConstCVImage();
+    sample(frame.getMat(cv::ACCESS_READ), transformation(img, d), data);
+}
+
+void FaceAligner::sample(const cv::Mat& src, const cv::Mat& H, float* data) const {
+    cv::Mat Hinv;
+    cv::invertAffineTransform(H, Hinv);
+    const double* h = Hinv.ptr<double>(0);
+
+    const int size = FACE_SIZE_CONSTRAINT;
+    float* r = data;
+    float* g = data + size*size;
+    float* b = data + 2*size*size;
+
+    // Bilinear sampling with a constant zero border, like cv::warpAffine.
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            double sx = h[0]*x + h[1]*y + h[2];
+            double sy = h[3]*x + h[4]*y + h[5];
+            int x0 = cvFloor(sx), y0 = cvFloor(sy);
+            float fx = sx - x0, fy = sy - y0;
+
+            float acc[3] = {0, 0, 0};
+            for (int dy = 0; dy < 2; dy++) {
+                int yy = y0 + dy;
+                if (yy < 0 || yy >= src.rows)
+                    continue;
+                const Pixel* row = src.ptr<Pixel>(yy);
+                float wy = dy ? fy : 1 - fy;
+                for (int dx = 0; dx < 2; dx++) {
+                    int xx = x0 + dx;
+                    if (xx < 0 || xx >= src.cols)
+                        continue;
+                    float w = wy * (dx ? fx : 1 - fx);
+                    acc[0] += w * row[xx][0];
+                    acc[1] += w * row[xx][1];
+                    acc[2] += w * row[xx][2];
+                }
+            }
+
+            int i = y*size + x;
+            r[i] = acc[2] / 255.f;
+            g[i] = acc[1] / 255.f;
+            b[i] = acc[0] / 255.f;
+        }
+    }
+}
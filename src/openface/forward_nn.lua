@@ -6,16 +6,26 @@ require 'image'
 torch.setdefaulttensortype('torch.FloatTensor')
 
 net = nil
-img = torch.Tensor(1, 3, 96, 96)
 
 function load(path)
     net = torch.load(path)
     net:evaluate()
 end
 
+function set_num_threads(n)
+    torch.setnumthreads(n)
+end
+
+-- Forwards a single 3x96x96 face. The batch dimension is added as a view,
+-- so the face is not copied.
 function forward_nn(data)
     assert(net, "NeuralNetwork has not been loaded. Run load() first.")
-    img[1] = data
-    rep = net:forward(img)
-    return(rep)
+    return net:forward(data:view(1, data:size(1), data:size(2), data:size(3)))
+end
+
+-- Forwards an Nx3x96x96 batch of faces. The tensor shares its storage with
+-- the C++ input tensor and is passed to the network without copying.
+function forward_nn_batch(data)
+    assert(net, "NeuralNetwork has not been loaded. Run load() first.")
+    return net:forward(data)
 end
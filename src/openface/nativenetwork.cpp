@@ -0,0 +1,860 @@
+#include "openface/nativenetwork.hpp"
+#include "core/support.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Layer types of the weight file, must match src/openface/convert_nn.lua
+enum LayerType {
+    SEQUENTIAL = 1, CONCAT, CONV, BATCHNORM, RELU, MAXPOOL, AVGPOOL, LRN,
+    LINEAR, NORMALIZE, RESHAPE, SQUARE, SQRT, MULCONSTANT, POWER, IDENTITY
+};
+
+const int32_t MAGIC = 0x4E4E464F; // "OFNN"
+const int32_t VERSION = 1;
+const int CALIBRATION_VERSION = 2;
+
+/**
+ * C[MxN] += A[MxK] * B[KxN], all row-major. Blocked over K and N so that the
+ * used rows of B stay in cache, the inner loop is contiguous and vectorizes.
+ */
+void gemm(int M, int N, int K, const float* A, const float* B, float* C) {
+    const int KB = 128, NB = 512;
+    for (int k0 = 0; k0 < K; k0 += KB) {
+        int k1 = std::min(K, k0 + KB);
+        for (int j0 = 0; j0 < N; j0 += NB) {
+            int j1 = std::min(N, j0 + NB);
+            for (int i = 0; i < M; i++) {
+                const float* a = A + i*K;
+                float* c = C + i*N;
+                for (int k = k0; k < k1; k++) {
+                    const float aik = a[k];
+                    const float* b = B + k*N;
+                    for (int j = j0; j < j1; j++)
+                        c[j] += aik * b[j];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * out[r] = W[r] * x for the #rows rows of W with #K values each, with int32
+ * accumulation. The activations x are unsigned 7 bit, so that the pairwise
+ * sums of the SIMD kernels cannot saturate, and K is a multiple of 64.
+ */
+void dot_rows_scalar(const int8_t* W, int rows, int K, const uint8_t* x, int32_t* out) {
+    for (int r = 0; r < rows; r++) {
+        const int8_t* w = W + (size_t)r*K;
+        int32_t sum = 0;
+        for (int k = 0; k < K; k++)
+            sum += (int16_t)x[k] * (int16_t)w[k];
+        out[r] = sum;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NATIVE_X86
+
+/**
+ * Stores the horizontal sums of four vectors of int32 to out[0..3].
+ */
+__attribute__((target("avx2")))
+inline void horizontal_sums(__m256i a, __m256i b, __m256i c, __m256i d, int32_t* out) {
+    __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(a, b), _mm256_hadd_epi32(c, d));
+    __m128i r = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+    _mm_storeu_si128((__m128i*)out, r);
+}
+
+/**
+ * maddubs multiplies 32 unsigned activations with 32 signed weights and adds
+ * adjacent products to 16 bit, madd with ones widens the sums to 32 bit. Four
+ * rows share every load of the activations.
+ */
+__attribute__((target("avx2")))
+void dot_rows_avx2(const int8_t* W, int rows, int K, const uint8_t* x, int32_t* out) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    int r = 0;
+    for (; r + 4 <= rows; r += 4) {
+        const int8_t* w = W + (size_t)r*K;
+        __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+        __m256i s2 = _mm256_setzero_si256(), s3 = _mm256_setzero_si256();
+        for (int k = 0; k < K; k += 32) {
+            const __m256i v = _mm256_loadu_si256((const __m256i*)(x + k));
+            s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_maddubs_epi16(v, _mm256_loadu_si256((const __m256i*)(w + k))), ones));
+            s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_maddubs_epi16(v, _mm256_loadu_si256((const __m256i*)(w + K + k))), ones));
+            s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_maddubs_epi16(v, _mm256_loadu_si256((const __m256i*)(w + 2*K + k))), ones));
+            s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_maddubs_epi16(v, _mm256_loadu_si256((const __m256i*)(w + 3*K + k))), ones));
+        }
+        horizontal_sums(s0, s1, s2, s3, out + r);
+    }
+    if (r < rows)
+        dot_rows_scalar(W + (size_t)r*K, rows - r, K, x, out + r);
+}
+
+/**
+ * Adds the upper to the lower half of a vector of int32.
+ */
+__attribute__((target("avx512f")))
+inline __m256i half_sum(__m512i v) {
+    int32_t lanes[16];
+    _mm512_storeu_si512(lanes, v);
+    return _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)lanes), _mm256_loadu_si256((const __m256i*)(lanes + 8)));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void dot_rows_avx512(const int8_t* W, int rows, int K, const uint8_t* x, int32_t* out) {
+    const __m512i ones = _mm512_set1_epi16(1);
+    int r = 0;
+    for (; r + 4 <= rows; r += 4) {
+        const int8_t* w = W + (size_t)r*K;
+        __m512i s0 = _mm512_setzero_si512(), s1 = _mm512_setzero_si512();
+        __m512i s2 = _mm512_setzero_si512(), s3 = _mm512_setzero_si512();
+        for (int k = 0; k < K; k += 64) {
+            const __m512i v = _mm512_loadu_si512(x + k);
+            s0 = _mm512_add_epi32(s0, _mm512_madd_epi16(_mm512_maddubs_epi16(v, _mm512_loadu_si512(w + k)), ones));
+            s1 = _mm512_add_epi32(s1, _mm512_madd_epi16(_mm512_maddubs_epi16(v, _mm512_loadu_si512(w + K + k)), ones));
+            s2 = _mm512_add_epi32(s2, _mm512_madd_epi16(_mm512_maddubs_epi16(v, _mm512_loadu_si512(w + 2*K + k)), ones));
+            s3 = _mm512_add_epi32(s3, _mm512_madd_epi16(_mm512_maddubs_epi16(v, _mm512_loadu_si512(w + 3*K + k)), ones));
+        }
+        horizontal_sums(half_sum(s0), half_sum(s1), half_sum(s2), half_sum(s3), out + r);
+    }
+    if (r < rows)
+        dot_rows_scalar(W + (size_t)r*K, rows - r, K, x, out + r);
+}
+
+#endif
+
+typedef void (*DotRowsKernel)(const int8_t*, int, int, const uint8_t*, int32_t*);
+
+DotRowsKernel dot_rows_kernel() {
+#ifdef NATIVE_X86
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return dot_rows_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return dot_rows_avx2;
+#endif
+    return dot_rows_scalar;
+}
+
+void dot_rows(const int8_t* W, int rows, int K, const uint8_t* x, int32_t* out) {
+    static const DotRowsKernel kernel = dot_rows_kernel();
+    kernel(W, rows, K, x, out);
+}
+
+/**
+ * Rows of the int8 matrices are padded with zeros to a multiple of 64 bytes.
+ */
+inline int padded(int K) {
+    return (K + 63) & ~63;
+}
+
+inline int8_t quantize(float v, float inv_scale) {
+    float q = std::round(v * inv_scale);
+    return (int8_t)std::max(-127.f, std::min(127.f, q));
+}
+
+/**
+ * Output size of a torch pooling layer along one dimension.
+ */
+int pooledSize(int in, int k, int d, int pad, bool ceil_mode) {
+    int out = ceil_mode ? (int)std::ceil((float)(in - k + 2*pad) / d) + 1
+                        : (int)std::floor((float)(in - k + 2*pad) / d) + 1;
+    // The last pooling window has to start inside the image.
+    if (pad && (out - 1)*d >= in + pad)
+        --out;
+    return out;
+}
+
+class Sequential : public NativeLayer {
+public:
+    std::vector<std::unique_ptr<NativeLayer> > layers;
+
+    void collect(std::vector<NativeLayer*>& out) {
+        for (size_t i = 0; i < layers.size(); i++)
+            layers[i]->collect(out);
+    }
+
+    void forward(const Blob& in, Blob& out) const {
+        if (layers.empty()) {
+            out = in;
+            return;
+        }
+        Blob tmp;
+        const Blob* src = &in;
+        for (size_t i = 0; i < layers.size(); i++) {
+            Blob& dst = (layers.size() - i) % 2 ? out : tmp;
+            layers[i]->forward(*src, dst);
+            src = &dst;
+        }
+    }
+};
+
+/**
+ * Concatenates the branch outputs along the channels. Smaller outputs are
+ * centered and zero padded, like torch's nn.DepthConcat.
+ */
+class Concat : public NativeLayer {
+public:
+    std::vector<std::unique_ptr<NativeLayer> > branches;
+
+    void collect(std::vector<NativeLayer*>& out) {
+        for (size_t i = 0; i < branches.size(); i++)
+            branches[i]->collect(out);
+    }
+
+    void forward(const Blob& in, Blob& out) const {
+        std::vector<Blob> outs(branches.size());
+        int c = 0, h = 0, w = 0;
+        for (size_t i = 0; i < branches.size(); i++) {
+            branches[i]->forward(in, outs[i]);
+            c += outs[i].c;
+            h = std::max(h, outs[i].h);
+            w = std::max(w, outs[i].w);
+        }
+
+        out = Blob(c, h, w);
+        int channel = 0;
+        for (size_t i = 0; i < outs.size(); i++) {
+            const Blob& b = outs[i];
+            int oy = (h - b.h) / 2, ox = (w - b.w) / 2;
+            for (int k = 0; k < b.c; k++, channel++) {
+                for (int y = 0; y < b.h; y++)
+                    std::copy(b.plane(k) + y*b.w, b.plane(k) + (y+1)*b.w,
+                              out.plane(channel) + (y+oy)*w + ox);
+            }
+        }
+    }
+};
+
+/**
+ * Layer computing out = weight * in + bias, which can run in int8.
+ *
+ * Weights are quantized per output channel to [-127, 127]. The input is
+ * quantized with a single scale derived from the range seen in calibration
+ * to unsigned 7 bit values: [0, 127] if it never was negative, like after a
+ * ReLU, and [1, 127] around a zero point of 64 otherwise.
+ */
+class Quantizable : public NativeLayer {
+public:
+    int nOut;
+    std::vector<float> weight; // nOut x K
+    std::vector<float> bias;
+
+    std::vector<int8_t> qweight; // nOut x padded(K)
+    std::vector<float> wscale;
+    std::vector<int32_t> wsum;
+    float input_max, input_min;
+    bool quantized;
+    bool calibrating;
+
+    Quantizable() : input_max(0), input_min(0), quantized(false), calibrating(false) {}
+
+    void observe(const Blob& in) {
+        for (size_t i = 0; i < in.data.size(); i++) {
+            input_max = std::max(input_max, std::abs(in.data[i]));
+            input_min = std::min(input_min, in.data[i]);
+        }
+    }
+
+    bool signed_input() const {return input_min < 0;}
+    uint8_t input_zero() const {return signed_input() ? 64 : 0;}
+
+    float input_scale() const {
+        const float levels = signed_input() ? 63.f : 127.f;
+        return input_max > 0 ? input_max / levels : 1.f;
+    }
+
+    uint8_t quantize_input(float v, float inv_scale) const {
+        // Rounds by truncation of the clamped non-negative value, which unlike
+        // std::round vectorizes
+        float q = v * inv_scale + input_zero() + 0.5f;
+        return (uint8_t)std::max(0.f, std::min(127.f, q));
+    }
+
+    /**
+     * Scales the int32 dot product of a row with quantized inputs back to float.
+     */
+    float dequantize(int o, int32_t acc, float scale) const {
+        return bias[o] + wscale[o] * scale * (acc - (int32_t)input_zero() * wsum[o]);
+    }
+
+    void quantize_weights() {
+        const size_t K = weight.size() / nOut, Kp = padded(K);
+        qweight.assign(nOut * Kp, 0);
+        wscale.resize(nOut);
+        wsum.assign(nOut, 0);
+        for (int o = 0; o < nOut; o++) {
+            float m = 0;
+            for (size_t k = 0; k < K; k++)
+                m = std::max(m, std::abs(weight[o*K + k]));
+            wscale[o] = m > 0 ? m / 127.f : 1.f;
+            for (size_t k = 0; k < K; k++) {
+                qweight[o*Kp + k] = quantize(weight[o*K + k], 1.f / wscale[o]);
+                wsum[o] += qweight[o*Kp + k];
+            }
+        }
+    }
+};
+
+class Conv : public Quantizable {
+public:
+    int nIn, kW, kH, dW, dH, padW, padH;
+
+    void forward(const Blob& in, Blob& out) const {
+        const int oh = (in.h + 2*padH - kH) / dH + 1;
+        const int ow = (in.w + 2*padW - kW) / dW + 1;
+        const int K = nIn*kH*kW, P = oh*ow;
+
+        if (calibrating)
+            const_cast<Conv*>(this)->observe(in);
+
+        out = Blob(nOut, oh, ow);
+        if (quantized) {
+            forward_int8(in, oh, ow, out);
+            return;
+        }
+
+        for (int o = 0; o < nOut; o++)
+            std::fill(out.plane(o), out.plane(o) + P, bias[o]);
+
+        // 1x1 convolutions without stride or padding need no unfolding.
+        if (pointwise()) {
+            gemm(nOut, P, K, weight.data(), in.data.data(), out.data.data());
+            return;
+        }
+
+        std::vector<float> cols((size_t)K*P);
+        im2col(in, oh, ow, cols.data());
+        gemm(nOut, P, K, weight.data(), cols.data(), out.data.data());
+    }
+
+    bool pointwise() const {
+        return kW == 1 && kH == 1 && dW == 1 && dH == 1 && padW == 0 && padH == 0;
+    }
+
+    /**
+     * Quantizes the input once and unfolds it pixel by pixel, so that each
+     * output pixel is a product of the weight rows with a contiguous row.
+     */
+    void forward_int8(const Blob& in, int oh, int ow, Blob& out) const {
+        const int K = nIn*kH*kW, Kp = padded(K), P = oh*ow, HW = in.h*in.w;
+        const float scale = input_scale(), inv_scale = 1.f / scale;
+        const uint8_t zero = input_zero();
+
+        std::vector<uint8_t> cols((size_t)P*Kp, 0);
+        if (pointwise()) {
+            // The pixel rows of a 1x1 convolution are the transposed input
+            for (int c = 0; c < nIn; c++) {
+                const float* plane = in.plane(c);
+                for (int p = 0; p < P; p++)
+                    cols[(size_t)p*Kp + c] = quantize_input(plane[p], inv_scale);
+            }
+        }
+        else {
+            std::vector<uint8_t> qin(in.data.size());
+            for (size_t i = 0; i < qin.size(); i++)
+                qin[i] = quantize_input(in.data[i], inv_scale);
+
+            for (int y = 0; y < oh; y++) {
+                for (int x = 0; x < ow; x++) {
+                    uint8_t* col = cols.data() + (size_t)(y*ow + x)*Kp;
+                    for (int c = 0; c < nIn; c++) {
+                        const uint8_t* plane = qin.data() + (size_t)c*HW;
+                        for (int ky = 0; ky < kH; ky++) {
+                            int iy = y*dH - padH + ky;
+                            for (int kx = 0; kx < kW; kx++) {
+                                int ix = x*dW - padW + kx;
+                                *col++ = (iy >= 0 && iy < in.h && ix >= 0 && ix < in.w) ?
+                                    plane[iy*in.w + ix] : zero;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        std::vector<int32_t> acc((size_t)P*nOut);
+        for (int p = 0; p < P; p++)
+            dot_rows(qweight.data(), nOut, Kp, cols.data() + (size_t)p*Kp, acc.data() + (size_t)p*nOut);
+        for (int o = 0; o < nOut; o++) {
+            float* plane = out.plane(o);
+            for (int p = 0; p < P; p++)
+                plane[p] = dequantize(o, acc[(size_t)p*nOut + o], scale);
+        }
+    }
+
+    void im2col(const Blob& in, int oh, int ow, float* cols) const {
+        for (int c = 0; c < nIn; c++) {
+            const float* plane = in.plane(c);
+            for (int ky = 0; ky < kH; ky++) {
+                for (int kx = 0; kx < kW; kx++) {
+                    float* row = cols + ((c*kH + ky)*kW + kx)*oh*ow;
+                    for (int y = 0; y < oh; y++) {
+                        int iy = y*dH - padH + ky;
+                        for (int x = 0; x < ow; x++) {
+                            int ix = x*dW - padW + kx;
+                            row[y*ow + x] = (iy >= 0 && iy < in.h && ix >= 0 && ix < in.w) ?
+                                plane[iy*in.w + ix] : 0.f;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Folds a following y = scale * x + shift into the weights and bias.
+     */
+    void fold(const std::vector<float>& scale, const std::vector<float>& shift) {
+        const int K = nIn*kH*kW;
+        for (int o = 0; o < nOut; o++) {
+            for (int k = 0; k < K; k++)
+                weight[o*K + k] *= scale[o];
+            bias[o] = bias[o]*scale[o] + shift[o];
+        }
+    }
+};
+
+/**
+ * Batch normalization with running statistics, y = scale * x + shift.
+ */
+class Affine : public NativeLayer {
+public:
+    std::vector<float> scale, shift;
+
+    void forward(const Blob& in, Blob& out) const {
+        out = in;
+        const int P = in.h*in.w;
+        for (int c = 0; c < in.c; c++) {
+            float* p = out.plane(c);
+            for (int i = 0; i < P; i++)
+                p[i] = scale[c]*p[i] + shift[c];
+        }
+    }
+};
+
+/**
+ * Element-wise layers: ReLU, Square, Sqrt, MulConstant and Power.
+ */
+class Elementwise : public NativeLayer {
+public:
+    LayerType type;
+    float param;
+
+    Elementwise(LayerType t, float p = 0) : type(t), param(p) {}
+
+    void forward(const Blob& in, Blob& out) const {
+        out = in;
+        std::vector<float>& d = out.data;
+        switch (type) {
+        case RELU:
+            for (size_t i = 0; i < d.size(); i++) d[i] = std::max(d[i], 0.f);
+            break;
+        case SQUARE:
+            for (size_t i = 0; i < d.size(); i++) d[i] = d[i]*d[i];
+            break;
+        case SQRT:
+            for (size_t i = 0; i < d.size(); i++) d[i] = std::sqrt(d[i] + param);
+            break;
+        case MULCONSTANT:
+            for (size_t i = 0; i < d.size(); i++) d[i] *= param;
+            break;
+        case POWER:
+            for (size_t i = 0; i < d.size(); i++) d[i] = std::pow(d[i], param);
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+class Pool : public NativeLayer {
+public:
+    bool max;
+    int kW, kH, dW, dH, padW, padH;
+    bool ceil_mode, count_include_pad;
+
+    void forward(const Blob& in, Blob& out) const {
+        const int oh = pooledSize(in.h, kH, dH, padH, ceil_mode);
+        const int ow = pooledSize(in.w, kW, dW, padW, ceil_mode);
+        out = Blob(in.c, oh, ow);
+
+        for (int c = 0; c < in.c; c++) {
+            const float* src = in.plane(c);
+            float* dst = out.plane(c);
+            for (int y = 0; y < oh; y++) {
+                for (int x = 0; x < ow; x++) {
+                    int y0 = y*dH - padH, x0 = x*dW - padW;
+                    int y1 = std::min(y0 + kH, in.h + padH), x1 = std::min(x0 + kW, in.w + padW);
+                    int pool_size = (y1 - y0)*(x1 - x0);
+                    y0 = std::max(y0, 0); x0 = std::max(x0, 0);
+                    y1 = std::min(y1, in.h); x1 = std::min(x1, in.w);
+
+                    float v = max ? -FLT_MAX : 0.f;
+                    for (int iy = y0; iy < y1; iy++) {
+                        for (int ix = x0; ix < x1; ix++) {
+                            v = max ? std::max(v, src[iy*in.w + ix]) : v + src[iy*in.w + ix];
+                        }
+                    }
+                    if (!max)
+                        v /= count_include_pad ? pool_size : (y1 - y0)*(x1 - x0);
+                    dst[y*ow + x] = v;
+                }
+            }
+        }
+    }
+};
+
+/**
+ * Local response normalization across channels, like nn.SpatialCrossMapLRN.
+ */
+class CrossMapLRN : public NativeLayer {
+public:
+    int size;
+    float alpha, beta, k;
+
+    void forward(const Blob& in, Blob& out) const {
+        const int P = in.h*in.w, half = (size - 1) / 2;
+        out = Blob(in.c, in.h, in.w);
+        std::vector<float> scale(P);
+
+        for (int c = 0; c < in.c; c++) {
+            std::fill(scale.begin(), scale.end(), 0.f);
+            for (int j = std::max(0, c - half); j <= std::min(in.c - 1, c + half); j++) {
+                const float* p = in.plane(j);
+                for (int i = 0; i < P; i++)
+                    scale[i] += p[i]*p[i];
+            }
+            const float* src = in.plane(c);
+            float* dst = out.plane(c);
+            for (int i = 0; i < P; i++)
+                dst[i] = src[i] * std::pow(k + alpha / size * scale[i], -beta);
+        }
+    }
+};
+
+class Linear : public Quantizable {
+public:
+    int nIn;
+
+    void forward(const Blob& in, Blob& out) const {
+        if ((int)in.data.size() != nIn)
+            throw std::runtime_error("Input of linear layer has the wrong size.");
+        if (calibrating)
+            const_cast<Linear*>(this)->observe(in);
+
+        out = Blob(nOut, 1, 1);
+        if (quantized) {
+            const float scale = input_scale(), inv_scale = 1.f / scale;
+            std::vector<uint8_t> x(padded(nIn), 0);
+            for (int i = 0; i < nIn; i++)
+                x[i] = quantize_input(in.data[i], inv_scale);
+            std::vector<int32_t> acc(nOut);
+            dot_rows(qweight.data(), nOut, padded(nIn), x.data(), acc.data());
+            for (int o = 0; o < nOut; o++)
+                out.data[o] = dequantize(o, acc[o], scale);
+            return;
+        }
+
+        std::copy(bias.begin(), bias.end(), out.data.begin());
+        gemm(nOut, 1, nIn, weight.data(), in.data.data(), out.data.data());
+    }
+};
+
+/**
+ * L2 normalization of the whole output, like nn.Normalize(2).
+ */
+class Normalize : public NativeLayer {
+public:
+    float eps;
+
+    void forward(const Blob& in, Blob& out) const {
+        out = in;
+        double sum = 0;
+        for (size_t i = 0; i < in.data.size(); i++)
+            sum += in.data[i]*in.data[i];
+        const float norm = std::sqrt(sum + eps);
+        for (size_t i = 0; i < out.data.size(); i++)
+            out.data[i] /= norm;
+    }
+};
+
+class Reshape : public NativeLayer {
+public:
+    void forward(const Blob& in, Blob& out) const {
+        out = in;
+        out.c = in.c*in.h*in.w;
+        out.h = out.w = 1;
+    }
+};
+
+class Reader {
+public:
+    Reader(const std::string& path) : path_(path), file_(path.c_str(), std::ios::binary) {
+        if (!file_)
+            throw std::runtime_error(std::string("No such file or directory: ")+path);
+    }
+
+    int32_t integer() {
+        int32_t v;
+        read(&v, sizeof(v));
+        return v;
+    }
+
+    float real() {
+        float v;
+        read(&v, sizeof(v));
+        return v;
+    }
+
+    std::vector<float> reals(size_t n) {
+        std::vector<float> v(n);
+        read(v.data(), n*sizeof(float));
+        return v;
+    }
+
+    void fail() {
+        throw std::runtime_error(std::string("Not a converted network: ")+path_);
+    }
+
+private:
+    void read(void* dst, size_t bytes) {
+        if (!file_.read((char*)dst, bytes))
+            fail();
+    }
+
+    std::string path_;
+    std::ifstream file_;
+};
+
+NativeLayer* readLayer(Reader& r) {
+    int32_t type = r.integer();
+    switch (type) {
+    case SEQUENTIAL: {
+        std::unique_ptr<Sequential> seq(new Sequential());
+        int32_t n = r.integer();
+        for (int32_t i = 0; i < n; i++) {
+            std::unique_ptr<NativeLayer> layer(readLayer(r));
+            Affine* bn = dynamic_cast<Affine*>(layer.get());
+            Conv* conv = seq->layers.empty() ? NULL : dynamic_cast<Conv*>(seq->layers.back().get());
+            if (bn && conv && (int)bn->scale.size() == conv->nOut)
+                conv->fold(bn->scale, bn->shift);
+            else
+                seq->layers.push_back(std::move(layer));
+        }
+        return seq.release();
+    }
+    case CONCAT: {
+        std::unique_ptr<Concat> concat(new Concat());
+        int32_t n = r.integer();
+        for (int32_t i = 0; i < n; i++)
+            concat->branches.push_back(std::unique_ptr<NativeLayer>(readLayer(r)));
+        return concat.release();
+    }
+    case CONV: {
+        std::unique_ptr<Conv> conv(new Conv());
+        conv->nIn = r.integer(); conv->nOut = r.integer();
+        conv->kW = r.integer(); conv->kH = r.integer();
+        conv->dW = r.integer(); conv->dH = r.integer();
+        conv->padW = r.integer(); conv->padH = r.integer();
+        conv->weight = r.reals((size_t)conv->nOut*conv->nIn*conv->kH*conv->kW);
+        conv->bias = r.reals(conv->nOut);
+        return conv.release();
+    }
+    case BATCHNORM: {
+        std::unique_ptr<Affine> bn(new Affine());
+        int32_t n = r.integer();
+        bn->scale = r.reals(n);
+        bn->shift = r.reals(n);
+        return bn.release();
+    }
+    case MAXPOOL:
+    case AVGPOOL: {
+        std::unique_ptr<Pool> pool(new Pool());
+        pool->max = type == MAXPOOL;
+        pool->kW = r.integer(); pool->kH = r.integer();
+        pool->dW = r.integer(); pool->dH = r.integer();
+        pool->padW = r.integer(); pool->padH = r.integer();
+        pool->ceil_mode = r.integer() != 0;
+        pool->count_include_pad = type == AVGPOOL ? r.integer() != 0 : false;
+        return pool.release();
+    }
+    case LRN: {
+        std::unique_ptr<CrossMapLRN> lrn(new CrossMapLRN());
+        lrn->size = r.integer();
+        lrn->alpha = r.real(); lrn->beta = r.real(); lrn->k = r.real();
+        return lrn.release();
+    }
+    case LINEAR: {
+        std::unique_ptr<Linear> linear(new Linear());
+        linear->nIn = r.integer(); linear->nOut = r.integer();
+        linear->weight = r.reals((size_t)linear->nOut*linear->nIn);
+        linear->bias = r.reals(linear->nOut);
+        return linear.release();
+    }
+    case NORMALIZE: {
+        std::unique_ptr<Normalize> norm(new Normalize());
+        norm->eps = r.real();
+        return norm.release();
+    }
+    case RESHAPE:
+        return new Reshape();
+    case RELU:
+    case SQUARE:
+        return new Elementwise((LayerType)type);
+    case SQRT:
+    case MULCONSTANT:
+    case POWER:
+        return new Elementwise((LayerType)type, r.real());
+    case IDENTITY:
+        return new Sequential();
+    default:
+        r.fail();
+        return NULL;
+    }
+}
+
+}
+
+NativeNetwork::NativeNetwork() : threads_(1), quantized_(false) {}
+
+NativeNetwork::NativeNetwork(const std::string& path) : threads_(1), quantized_(false) {
+    load(path);
+}
+
+NativeNetwork::~NativeNetwork() {}
+
+void NativeNetwork::load(const std::string& path) {
+    Reader r(path);
+    if (r.integer() != MAGIC || r.integer() != VERSION)
+        r.fail();
+
+    root_.reset(readLayer(r));
+    layers_.clear();
+    root_->collect(layers_);
+    quantized_ = false;
+}
+
+std::vector<std::vector<float> > NativeNetwork::forward(const float* input, size_t n, int height, int width) const {
+    ASSERT(root_, "NativeNetwork has not been loaded. Run load() first.");
+
+    std::vector<std::vector<float> > out(n);
+    const size_t size = 3*height*width;
+    parallel_for(n, threads_, [&](size_t i) {
+        Blob in(3, height, width), result;
+        std::copy(input + i*size, input + (i+1)*size, in.data.begin());
+        root_->forward(in, result);
+        out[i].swap(result.data);
+    });
+
+    return out;
+}
+
+void NativeNetwork::calibrate(const float* input, size_t n, int height, int width) {
+    ASSERT(root_, "NativeNetwork has not been loaded. Run load() first.");
+
+    bool quantized = quantized_;
+    int threads = threads_;
+    set_quantized(false);
+    threads_ = 1;
+
+    for (size_t i = 0; i < layers_.size(); i++) {
+        Quantizable* q = dynamic_cast<Quantizable*>(layers_[i]);
+        if (q)
+            q->calibrating = true;
+    }
+    forward(input, n, height, width);
+    for (size_t i = 0; i < layers_.size(); i++) {
+        Quantizable* q = dynamic_cast<Quantizable*>(layers_[i]);
+        if (q)
+            q->calibrating = false;
+    }
+
+    threads_ = threads;
+    set_quantized(quantized, true);
+}
+
+void NativeNetwork::set_quantized(bool quantized, bool keep_float_weights) {
+    for (size_t i = 0; i < layers_.size(); i++) {
+        Quantizable* q = dynamic_cast<Quantizable*>(layers_[i]);
+        if (!q)
+            continue;
+        if (quantized && q->input_max <= 0)
+            throw std::runtime_error("NativeNetwork has to be calibrated before it can be quantized.");
+        if (!quantized && q->weight.empty())
+            throw std::runtime_error("Float weights have been released, load the network again.");
+    }
+
+    for (size_t i = 0; i < layers_.size(); i++) {
+        Quantizable* q = dynamic_cast<Quantizable*>(layers_[i]);
+        if (!q)
+            continue;
+        if (quantized && q->qweight.empty())
+            q->quantize_weights();
+        if (quantized && !keep_float_weights)
+            std::vector<float>().swap(q->weight);
+        q->quantized = quantized;
+    }
+    quantized_ = quantized;
+}
+
+size_t NativeNetwork::weight_bytes() const {
+    size_t bytes = 0;
+    for (size_t i = 0; i < layers_.size(); i++) {
+        const Quantizable* q = dynamic_cast<const Quantizable*>(layers_[i]);
+        if (!q)
+            continue;
+        bytes += q->bias.size() * sizeof(float);
+        bytes += q->weight.size() * sizeof(float);
+        bytes += q->qweight.size() + q->wscale.size() * sizeof(float) + q->wsum.size() * sizeof(int32_t);
+    }
+    return bytes;
+}
+
+void NativeNetwork::save_calibration(const std::string& path) const {
+    std::ofstream file(path.c_str());
+    if (!file)
+        throw std::runtime_error(std::string("Directory does not exist: ")+path);
+
+    file.precision(9);
+    file << "OFNN-calibration " << CALIBRATION_VERSION << std::endl;
+    for (size_t i = 0; i < layers_.size(); i++) {
+        const Quantizable* q = dynamic_cast<const Quantizable*>(layers_[i]);
+        if (q)
+            file << q->input_max << " " << q->input_min << std::endl;
+    }
+}
+
+void NativeNetwork::load_calibration(const std::string& path) {
+    std::ifstream file(path.c_str());
+    if (!file)
+        throw std::runtime_error(std::string("No such file or directory: ")+path);
+
+    std::string header;
+    int version = 0;
+    file >> header >> version;
+    if (header != "OFNN-calibration" || version != CALIBRATION_VERSION)
+        throw std::runtime_error(std::string("Not a calibration file: ")+path);
+
+    for (size_t i = 0; i < layers_.size(); i++) {
+        Quantizable* q = dynamic_cast<Quantizable*>(layers_[i]);
+        if (!q)
+            continue;
+        if (!(file >> q->input_max >> q->input_min))
+            throw std::runtime_error(std::string("Calibration does not match the network: ")+path);
+    }
+    float extra;
+    if (file >> extra)
+        throw std::runtime_error(std::string("Calibration does not match the network: ")+path);
+}
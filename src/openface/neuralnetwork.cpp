@@ -1,32 +1,167 @@
 #include "openface/neuralnetwork.hpp"
 #include "openface/settings.hpp"
+#include "core/support.hpp"
 
-NeuralNetwork::NeuralNetwork(const std::string script_path, const std::string nn_path) {
+#include <algorithm>
+
+NeuralNetwork::NeuralNetwork(const std::string script_path, const std::string nn_path)
+    : inputs_(FACE_SIZE_CONSTRAINT, FACE_SIZE_CONSTRAINT), forward_ref_(LUA_NOREF), batch_size_(MAX_BATCH_SIZE) {
     load(script_path, nn_path);
 }
 
+NeuralNetwork::NeuralNetwork(const std::string weights_path)
+    : inputs_(FACE_SIZE_CONSTRAINT, FACE_SIZE_CONSTRAINT), forward_ref_(LUA_NOREF), batch_size_(MAX_BATCH_SIZE) {
+    load(weights_path);
+}
+
+void NeuralNetwork::load(const std::string weights_path) {
+    native_.reset(new NativeNetwork(weights_path));
+
+    initialized_ = true;
+}
+
 void NeuralNetwork::load(const std::string script_path, const std::string nn_path) {
+    native_.reset();
     torch.doFile(script_path);
     torch["load"](nn_path);
 
+    lua_State* L = torch.getState();
+    lua_getglobal(L, "forward_nn_batch");
+    if (!lua_isfunction(L, -1)) {
+        lua_pop(L, 1);
+        throw std::runtime_error(std::string("No forward_nn_batch function defined in ")+script_path);
+    }
+    // A previous script's function is released before pinning the new one
+    luaL_unref(L, LUA_REGISTRYINDEX, forward_ref_);
+    forward_ref_ = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    // Input tensors pushed to lua are only released by its garbage collector.
+    inputs_.set_collector([this]() { lua_gc(torch.getState(), LUA_GCCOLLECT, 0); });
+
     initialized_ = true;
 }
 
 FaceNetEmbed NeuralNetwork::forward_nn(const Image &img) const {
     assert(initialized_);
-    
-    Tensor face(img);
-    Tensor output = torch["forward_nn"](face);
-    FaceNetEmbed mapping = dlib::mat(TensorData(output.raw()), 128);
 
-    return mapping;
+    Tensor face = input(1);
+    face.copy(0, img);
+
+    return forward_nn(face)[0];
 }
 
 std::vector<FaceNetEmbed> NeuralNetwork::forward_nn(const std::vector<Image> &imgs) const {
+    assert(initialized_);
+
     std::vector<FaceNetEmbed> out;
-    for (size_t i = 0; i < imgs.size(); i++) {
-        out.push_back(forward_nn(imgs[i]));
+    out.reserve(imgs.size());
+    for (size_t begin = 0; begin < imgs.size(); begin += batch_size_) {
+        size_t end = std::min(imgs.size(), begin + batch_size_);
+
+        Tensor batch = input(end - begin);
+        for (size_t i = begin; i < end; i++) {
+            batch.copy(i - begin, imgs[i]);
+        }
+        std::vector<FaceNetEmbed> mappings = forward_nn(batch);
+        out.insert(out.end(), mappings.begin(), mappings.end());
     }
 
     return out;
 }
+
+Tensor NeuralNetwork::input(size_t n) const {
+    assert(n > 0 && n <= (size_t)batch_size_);
+    return inputs_.acquire(n);
+}
+
+std::vector<FaceNetEmbed> NeuralNetwork::forward_nn(Tensor& input) const {
+    assert(initialized_);
+
+    size_t n = THFloatTensor_size(input.raw(), 0);
+
+    if (native_) {
+        std::vector<std::vector<float> > outputs = native_->forward(TensorData(input.raw()), n,
+            THFloatTensor_size(input.raw(), 2), THFloatTensor_size(input.raw(), 3));
+
+        std::vector<FaceNetEmbed> out;
+        out.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            if (outputs[i].size() != 128)
+                throw std::runtime_error("Native network does not output 128-dimensional embeddings.");
+            FaceNetEmbed mapping = dlib::mat(outputs[i].data(), 128);
+            out.push_back(mapping);
+        }
+        return out;
+    }
+
+    lua_State* L = torch.getState();
+    lua_rawgeti(L, LUA_REGISTRYINDEX, forward_ref_);
+    lua::stack::push(L, input);
+    if (lua_pcall(L, 1, 1, 0) != 0) {
+        const char* message = lua_tostring(L, -1);
+        std::string error = message ? message : "forward_nn_batch raised a non-string error";
+        lua_pop(L, 1);
+        throw std::runtime_error(error);
+    }
+    Tensor output = lua::stack::read<Tensor>(L, -1);
+    lua_pop(L, 1);
+    if (!output.raw())
+        throw std::runtime_error("forward_nn_batch did not return a torch.FloatTensor");
+    ASSERT(THFloatTensor_isContiguous(output.raw()), "Network output is not contiguous.");
+
+    std::vector<FaceNetEmbed> out;
+    out.reserve(n);
+    const float* data = TensorData(output.raw());
+    for (size_t i = 0; i < n; i++) {
+        FaceNetEmbed mapping = dlib::mat(data + 128*i, 128);
+        out.push_back(mapping);
+    }
+
+    return out;
+}
+
+void NeuralNetwork::set_batch_size(int size) {
+    if (size <= 0)
+        throw std::runtime_error("Batch size must be positive.");
+    batch_size_ = size;
+}
+
+void NeuralNetwork::set_num_threads(int threads) {
+    assert(initialized_);
+    if (native_)
+        native_->set_num_threads(threads);
+    else
+        torch["set_num_threads"](threads);
+}
+
+NativeNetwork& NeuralNetwork::native_network() const {
+    if (!native_)
+        throw std::runtime_error("Quantization is only supported by the native network backend.");
+    return *native_;
+}
+
+void NeuralNetwork::calibrate(const std::vector<Image>& faces) {
+    assert(initialized_);
+    NativeNetwork& nn = native_network();
+    for (size_t i = 0; i < faces.size(); i += batch_size_) {
+        size_t end = std::min(faces.size(), i + batch_size_);
+        Tensor tensor(faces, i, end);
+        nn.calibrate(TensorData(tensor.raw()), end - i,
+            THFloatTensor_size(tensor.raw(), 2), THFloatTensor_size(tensor.raw(), 3));
+    }
+}
+
+void NeuralNetwork::set_quantized(bool quantized, bool keep_float_weights) {
+    assert(initialized_);
+    native_network().set_quantized(quantized, keep_float_weights);
+}
+
+void NeuralNetwork::quantize(const std::string& calibration_path) {
+    assert(initialized_);
+    native_network().load_calibration(calibration_path);
+    native_network().set_quantized(true);
+}
+
+void NeuralNetwork::save_calibration(const std::string& calibration_path) const {
+    native_network().save_calibration(calibration_path);
+}
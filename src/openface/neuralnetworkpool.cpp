@@ -0,0 +1,77 @@
+#include "openface/neuralnetworkpool.hpp"
+#include "core/support.hpp"
+
+#include <algorithm>
+#include <thread>
+
+NeuralNetworkPool::NeuralNetworkPool(const std::string script_path, const std::string nn_path, int size)
+    : next_(0), initialized_(false) {
+    load(script_path, nn_path, size);
+}
+
+void NeuralNetworkPool::load(const std::string script_path, const std::string nn_path, int size) {
+    assert(!initialized_);
+    if (size <= 0)
+        size = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 0; i < size; i++) {
+        networks_.push_back(std::unique_ptr<NeuralNetwork>(new NeuralNetwork(script_path, nn_path)));
+        networks_.back()->set_num_threads(1);
+    }
+
+    busy_.reset(new std::atomic<bool>[size]);
+    for (int i = 0; i < size; i++)
+        busy_[i] = false;
+
+    initialized_ = true;
+}
+
+void NeuralNetworkPool::set_batch_size(int size) {
+    for (size_t i = 0; i < networks_.size(); i++)
+        networks_[i]->set_batch_size(size);
+}
+
+size_t NeuralNetworkPool::checkout() const {
+    assert(initialized_);
+    const size_t n = networks_.size();
+
+    for (;;) {
+        size_t start = next_.fetch_add(1, std::memory_order_relaxed);
+        for (size_t k = 0; k < n; k++) {
+            size_t i = (start + k) % n;
+            bool expected = false;
+            if (busy_[i].compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return i;
+        }
+        std::this_thread::yield();
+    }
+}
+
+void NeuralNetworkPool::checkin(size_t i) const {
+    busy_[i].store(false, std::memory_order_release);
+}
+
+FaceNetEmbed NeuralNetworkPool::forward_nn(const Image& img) const {
+    Lease lease(*this);
+    return lease.nn().forward_nn(img);
+}
+
+std::vector<FaceNetEmbed> NeuralNetworkPool::forward_nn(const std::vector<Image>& imgs) const {
+    assert(initialized_);
+
+    const size_t batch = networks_[0]->batch_size();
+    const size_t batches = (imgs.size() + batch - 1) / batch;
+    std::vector<FaceNetEmbed> out(imgs.size());
+
+    parallel_for(batches, size(), [&](size_t b) {
+        std::vector<Image>::const_iterator first = imgs.begin() + b*batch;
+        std::vector<Image>::const_iterator last = imgs.begin() + std::min(imgs.size(), (b+1)*batch);
+        std::vector<Image> faces(first, last);
+
+        Lease lease(*this);
+        std::vector<FaceNetEmbed> reps = lease.nn().forward_nn(faces);
+        std::copy(reps.begin(), reps.end(), out.begin() + b*batch);
+    });
+
+    return out;
+}
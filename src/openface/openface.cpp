@@ -1,5 +1,7 @@
 #include "openface/openface.hpp"
 
+#include <algorithm>
+
 OpenFace::OpenFace(const std::string& shape_path, const std::string& script_path, const std::string& nn_path) {
     load(shape_path, script_path, nn_path);
 }
@@ -11,21 +13,29 @@ void OpenFace::load(const std::string& shape_path, const std::string &script_pat
     initialized_ = true;
 }
 
-FaceNetEmbed OpenFace::facenet(Detection& d) {
+FaceNetEmbed OpenFace::facenet(const Detection& d) {
     assert(initialized_);
 
-    fa_.align(d);
+    Tensor input = nn_.input(1);
+    fa_.align(d, TensorData(input.raw()));
 
-    return nn_.forward_nn(d.face);
+    return nn_.forward_nn(input)[0];
 }
 
-std::vector<FaceNetEmbed> OpenFace::facenet(std::vector<Detection>& ds) {
-    fa_.align(ds);
+std::vector<FaceNetEmbed> OpenFace::facenet(const std::vector<Detection>& ds) {
+    assert(initialized_);
+
+    std::vector<FaceNetEmbed> out;
+    out.reserve(ds.size());
+    for (size_t begin = 0; begin < ds.size(); begin += nn_.batch_size()) {
+        size_t end = std::min(ds.size(), begin + nn_.batch_size());
+
+        Tensor input = nn_.input(end - begin);
+        fa_.align(ds.data() + begin, end - begin, TensorData(input.raw()));
 
-    std::vector<Image> faces;
-    for (size_t i = 0; i < ds.size(); i++) {
-        faces.push_back(ds[i].face);
+        std::vector<FaceNetEmbed> mappings = nn_.forward_nn(input);
+        out.insert(out.end(), mappings.begin(), mappings.end());
     }
 
-    return nn_.forward_nn(faces);
+    return out;
 }
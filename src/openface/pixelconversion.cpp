@@ -0,0 +1,132 @@
+#include "openface/pixelconversion.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXELCONVERSION_X86
+#include <immintrin.h>
+#endif
+
+void bgr_to_planar_rgb_scalar(const unsigned char* bgr, size_t n, float* r, float* g, float* b) {
+    for (size_t i = 0; i < n; ++i) {
+        r[i] = bgr[3*i+2] / 255.f;
+        g[i] = bgr[3*i+1] / 255.f;
+        b[i] = bgr[3*i  ] / 255.f;
+    }
+}
+
+#ifdef PIXELCONVERSION_X86
+
+/**
+ * Splits 16 interleaved BGR pixels (48 bytes) into one register per channel.
+ */
+__attribute__((target("ssse3")))
+static inline void deinterleave16(const unsigned char* src, __m128i& b, __m128i& g, __m128i& r) {
+    const __m128i a0 = _mm_loadu_si128((const __m128i*)(src));
+    const __m128i a1 = _mm_loadu_si128((const __m128i*)(src + 16));
+    const __m128i a2 = _mm_loadu_si128((const __m128i*)(src + 32));
+
+    b = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(a0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    g = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(a0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    r = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(a0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+/**
+ * Converts 16 bytes to floats divided by 255 using 128 bit registers.
+ */
+__attribute__((target("ssse3,sse4.1")))
+static inline void convert16_sse(__m128i v, float* dst) {
+    const __m128 scale = _mm_set1_ps(255.f);
+    for (int k = 0; k < 4; ++k) {
+        __m128 f = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(v));
+        _mm_storeu_ps(dst + 4*k, _mm_div_ps(f, scale));
+        v = _mm_srli_si128(v, 4);
+    }
+}
+
+/**
+ * Converts 16 bytes to floats divided by 255 using 256 bit registers.
+ */
+__attribute__((target("avx2")))
+static inline void convert16_avx2(__m128i v, float* dst) {
+    const __m256 scale = _mm256_set1_ps(255.f);
+    __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+    __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+    _mm256_storeu_ps(dst, _mm256_div_ps(lo, scale));
+    _mm256_storeu_ps(dst + 8, _mm256_div_ps(hi, scale));
+}
+
+__attribute__((target("ssse3,sse4.1")))
+void bgr_to_planar_rgb_sse(const unsigned char* bgr, size_t n, float* r, float* g, float* b) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i vb, vg, vr;
+        deinterleave16(bgr + 3*i, vb, vg, vr);
+        convert16_sse(vr, r + i);
+        convert16_sse(vg, g + i);
+        convert16_sse(vb, b + i);
+    }
+    bgr_to_planar_rgb_scalar(bgr + 3*i, n - i, r + i, g + i, b + i);
+}
+
+__attribute__((target("avx2")))
+void bgr_to_planar_rgb_avx2(const unsigned char* bgr, size_t n, float* r, float* g, float* b) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i vb, vg, vr;
+        deinterleave16(bgr + 3*i, vb, vg, vr);
+        convert16_avx2(vr, r + i);
+        convert16_avx2(vg, g + i);
+        convert16_avx2(vb, b + i);
+    }
+    bgr_to_planar_rgb_scalar(bgr + 3*i, n - i, r + i, g + i, b + i);
+}
+
+#else
+
+void bgr_to_planar_rgb_sse(const unsigned char*, size_t, float*, float*, float*) {
+    throw std::runtime_error("SSE4.1 is not available on this platform.");
+}
+
+void bgr_to_planar_rgb_avx2(const unsigned char*, size_t, float*, float*, float*) {
+    throw std::runtime_error("AVX2 is not available on this platform.");
+}
+
+#endif
+
+bool bgr_to_planar_rgb_supported(const char* isa) {
+    if (strcmp(isa, "scalar") == 0)
+        return true;
+#ifdef PIXELCONVERSION_X86
+    if (strcmp(isa, "sse4.1") == 0)
+        return __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+    if (strcmp(isa, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+#endif
+    return false;
+}
+
+const char* bgr_to_planar_rgb_isa() {
+    static const char* isa = bgr_to_planar_rgb_supported("avx2") ? "avx2" :
+                             bgr_to_planar_rgb_supported("sse4.1") ? "sse4.1" : "scalar";
+    return isa;
+}
+
+void bgr_to_planar_rgb(const unsigned char* bgr, size_t n, float* r, float* g, float* b) {
+    typedef void (*Kernel)(const unsigned char*, size_t, float*, float*, float*);
+    static const Kernel kernel =
+        strcmp(bgr_to_planar_rgb_isa(), "avx2") == 0 ? bgr_to_planar_rgb_avx2 :
+        strcmp(bgr_to_planar_rgb_isa(), "sse4.1") == 0 ? bgr_to_planar_rgb_sse :
+        bgr_to_planar_rgb_scalar;
+    kernel(bgr, n, r, g, b);
+}
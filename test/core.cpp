@@ -198,6 +198,61 @@ TEST (ImageTest, SafeOpenCVTransformation) {
     EXPECT_EQ(rgbdata[0][2], 0);
 }
 
+/**
+ * @fn Image::Image(const Image&, const Rectangle&)
+ *
+ * @test
+ * The region is copied, so the cropped image is not changed with the source.
+ */
+TEST (ImageTest, ConstructingFromRegion) {
+    cv::Mat mat(40, 60, CV_8UC3, cv::Scalar(1, 2, 3));
+    Image frame(mat);
+    Image crop(frame, Rectangle(10, 5, 20, 30));
+
+    EXPECT_EQ(20, crop.width());
+    EXPECT_EQ(30, crop.height());
+    frame.asCVImage().setTo(cv::Scalar(0, 0, 0));
+    EXPECT_EQ(3, crop.pixeldata()[0][2]);
+}
+
+/**
+ * @fn Image::warpAffine()
+ *
+ * @test
+ * Warping a small region of a large image only reads the region around it,
+ * but yields the same pixels as warping the whole image, and leaves images
+ * sharing the data untouched.
+ */
+TEST (ImageTest, WarpAffineRegion) {
+    cv::Mat mat(480, 640, CV_8UC3);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(255));
+    Image frame(mat);
+    Image face = frame;
+
+    // Rotated and scaled crop around (300, 200), partly outside at the border
+    cv::Mat H = cv::getRotationMatrix2D(cv::Point2f(300, 200), 15, 0.8);
+    H.at<double>(0, 2) -= 250;
+    H.at<double>(1, 2) -= 150;
+    cv::Mat expected;
+    cv::warpAffine(mat, expected, H, cv::Size(96, 96));
+
+    face.warpAffine(H, cv::Size(96, 96));
+    ASSERT_EQ(96, face.width());
+    cv::Mat diff;
+    cv::absdiff(face.asConstCVImage(), expected, diff);
+    double max;
+    cv::minMaxLoc(diff.reshape(1), nullptr, &max);
+    EXPECT_LE(max, 1);
+
+    EXPECT_EQ(640, frame.width());
+    EXPECT_EQ(0, cv::norm(frame.asConstCVImage(), mat, cv::NORM_INF));
+
+    cv::Mat border = (cv::Mat_<double>(2, 3) << 1, 0, -600, 0, 1, -440);
+    face = frame;
+    face.warpAffine(border, cv::Size(96, 96));
+    EXPECT_EQ(0, face.pixeldata()[95*96 + 95][0]);
+}
+
 /**
  *
  * Rectangle Tests
@@ -290,6 +345,22 @@ TEST(RectangleTest, OpenCVConstruction) {
     EXPECT_EQ(100, rect2.area());
 }
 
+/**
+ * @fn Rectangle::iou()
+ *
+ * @test
+ * Intersection over union of identical, overlapping, disjoint and empty
+ * rectangles.
+ */
+TEST(RectangleTest, IntersectionOverUnion) {
+    Rectangle rect(0, 0, 10, 10);
+
+    EXPECT_DOUBLE_EQ(1, rect.iou(rect));
+    EXPECT_DOUBLE_EQ(50. / 150, rect.iou(Rectangle(5, 0, 10, 10)));
+    EXPECT_DOUBLE_EQ(0, rect.iou(Rectangle(20, 20, 5, 5)));
+    EXPECT_DOUBLE_EQ(0, Rectangle().iou(Rectangle()));
+}
+
 /**
  * @fn Rectangle::asCVRect()
  *
@@ -1,4 +1,6 @@
 #include "detection/facedetector.hpp"
+#include "detection/videosession.hpp"
+#include "detection/motiongate.hpp"
 #include "openface/facealigner.hpp"
 #include <gtest/gtest.h>
 
@@ -83,4 +85,309 @@ TEST_F (FaceDetectorTest, NoFace) {
 }
 
 
+/**
+ * @fn FaceDetector::detect_all()
+ *
+ * @test
+ * All faces of an image with two faces side by side are found, and the
+ * detections share the pixels of the frame instead of copying them.
+ */
+TEST_F (FaceDetectorTest, DetectAllFaces) {
+    cv::Mat twice;
+    cv::hconcat(img.asConstCVImage().getMat(cv::ACCESS_READ),
+                img.asConstCVImage().getMat(cv::ACCESS_READ), twice);
+    Image frame(twice);
+
+    std::vector<Detection> ds = fd.detect_all(frame);
+    std::vector<Detection> cv_ds = fd.cv_detect_all(frame);
+
+    ASSERT_EQ(2u, ds.size());
+    EXPECT_EQ(2u, cv_ds.size());
+    EXPECT_NE(ds[0].rect.x() < img.width(), ds[1].rect.x() < img.width());
+    for (size_t i = 0; i < ds.size(); i++) {
+        EXPECT_EQ(frame.pixeldata(), ds[i].face.pixeldata());
+    }
+    EXPECT_TRUE(fd.detect_all(noFace).empty());
+}
+
+/**
+ * @fn FaceDetector::detect(const std::vector<Image>&)
+ *
+ * @test
+ * Detecting on several threads returns the same detections in the same order
+ * as detecting on a single thread.
+ */
+TEST_F (FaceDetectorTest, ParallelDetect) {
+    std::vector<Image> imgs;
+    for (int i = 0; i < 8; i++)
+        imgs.push_back(i % 3 ? img : noFace);
+
+    fd.set_threads(1);
+    std::vector<Detection> expected = fd.detect(imgs);
+    fd.set_threads(4);
+    std::vector<Detection> ds = fd.detect(imgs);
+
+    ASSERT_EQ(imgs.size(), ds.size());
+    for (size_t i = 0; i < ds.size(); i++) {
+        EXPECT_EQ(expected[i].rect.asCVRect(), ds[i].rect.asCVRect());
+        EXPECT_EQ(i % 3 != 0, ds[i].rect.area() > 0);
+    }
+}
+
+/**
+ * @fn FaceDetector::set_scale()
+ *
+ * @test
+ * Detecting on a downscaled copy finds the face and maps the rectangle back
+ * close to the rectangle found at full resolution.
+ */
+TEST_F (FaceDetectorTest, DetectScaled) {
+    Detection expected = fd.dlib_detect(img);
+    fd.set_scale(0.5);
+    Detection d = fd.dlib_detect(img);
+
+    ASSERT_LT(0, d.rect.area());
+    EXPECT_GT(expected.rect.iou(d.rect), 0.5);
+
+    fd.set_min_face_size(40);
+    EXPECT_EQ(1., fd.scale());
+    EXPECT_THROW(fd.set_scale(0), std::runtime_error);
+}
+
+/**
+ * @fn VideoSession::process()
+ *
+ * @test
+ * A face moving slowly through the frames keeps its id, is tracked between
+ * keyframes and the detector only runs on keyframes.
+ */
+TEST_F (FaceDetectorTest, VideoSessionTracking) {
+    VideoSession session(fd, 5);
+    cv::Mat src = img.asConstCVImage().getMat(cv::ACCESS_READ);
+    Detection first = fd.dlib_detect(img);
+
+    for (int i = 0; i < 10; i++) {
+        cv::Mat shifted;
+        cv::Mat H = (cv::Mat_<double>(2, 3) << 1, 0, 2*i, 0, 1, i);
+        cv::warpAffine(src, shifted, H, src.size());
+        Image frame(shifted);
+
+        std::vector<Track> tracks = session.process(frame);
+
+        ASSERT_EQ(1u, tracks.size());
+        EXPECT_EQ(0, tracks[0].id);
+        EXPECT_EQ(i % 5 == 0, session.keyframe());
+        Rectangle expected(first.rect.x() + 2*i, first.rect.y() + i, first.rect.width(), first.rect.height());
+        EXPECT_GT(expected.iou(tracks[0].detection.rect), 0.5);
+    }
+
+    EXPECT_TRUE(session.process(noFace).empty() || session.keyframe());
+}
+
+/**
+ * @fn VideoSession::set_empty_interval()
+ *
+ * @test
+ * Frames without faces are not all keyframes, the detector runs every
+ * empty_interval() frames until a face is found.
+ */
+TEST_F (FaceDetectorTest, VideoSessionEmptyScene) {
+    VideoSession session(fd, 5);
+    EXPECT_EQ(5, session.empty_interval());
+    session.set_empty_interval(3);
+
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(session.process(noFace).empty());
+        EXPECT_EQ(i % 3 == 0, session.keyframe());
+    }
+
+    // The face is found on the next keyframe
+    EXPECT_TRUE(session.process(img).empty());
+    EXPECT_FALSE(session.keyframe());
+    EXPECT_EQ(1u, session.process(img).size());
+    EXPECT_TRUE(session.keyframe());
+
+    EXPECT_THROW(session.set_empty_interval(0), std::runtime_error);
+}
+
+/**
+ * @fn MotionGate::detect_all()
+ *
+ * @test
+ * An unchanged frame reuses the detections without running the detector,
+ * motion away from the face keeps the face, and the hit rate counts the
+ * skipped frames.
+ */
+TEST_F (FaceDetectorTest, MotionGateSkipsStaticFrames) {
+    MotionGate gate(fd);
+    std::vector<Detection> first = gate.detect_all(img);
+    ASSERT_EQ(1u, first.size());
+
+    std::vector<Detection> same = gate.detect_all(img);
+    ASSERT_EQ(1u, same.size());
+    EXPECT_EQ(first[0].rect.asCVRect(), same[0].rect.asCVRect());
+    EXPECT_EQ(1u, gate.hits());
+
+    // Something moves in the corner farthest away from the face
+    cv::Mat moved = img.asConstCVImage().getMat(cv::ACCESS_READ).clone();
+    Rectangle face = first[0].rect;
+    int x = face.x() + face.width()/2 < img.width()/2 ? img.width() - 40 : 0;
+    int y = face.y() + face.height()/2 < img.height()/2 ? img.height() - 40 : 0;
+    cv::rectangle(moved, cv::Rect(x, y, 40, 40), cv::Scalar(255, 255, 255), -1);
+    Image frame(moved);
+
+    std::vector<Detection> ds = gate.detect_all(frame);
+    ASSERT_EQ(1u, ds.size());
+    EXPECT_GT(face.iou(ds[0].rect), 0.9);
+    EXPECT_EQ(frame.pixeldata(), ds[0].face.pixeldata());
+    EXPECT_DOUBLE_EQ(1./3, gate.hit_rate());
+}
+
+/**
+ * @fn FaceDetector::cascade_detect_all()
+ *
+ * @test
+ * The cascade finds the face found by HOG at the same position, and nothing
+ * in the image without a face.
+ */
+TEST_F (FaceDetectorTest, DetectFaceCascade) {
+    Detection expected = fd.dlib_detect(img);
+    fd.set_mode(CASCADE);
+    std::vector<Detection> ds = fd.detect_all(img);
+
+    ASSERT_EQ(1u, ds.size());
+    EXPECT_GT(expected.rect.iou(ds[0].rect), 0.9);
+    EXPECT_EQ(0, fd.detect(noFace).rect.area());
+}
+
+/**
+ * @fn FaceDetector::set_score_threshold()
+ *
+ * @test
+ * Detections carry the score of the detector and are dropped if the score is
+ * below the threshold or the face is smaller than the minimum face size.
+ */
+TEST_F (FaceDetectorTest, DetectionScores) {
+    Detection d = fd.dlib_detect(img);
+    ASSERT_LT(0, d.rect.area());
+    EXPECT_GE(d.score, 0);
+    EXPECT_GE(d.weight_index, 0);
+
+    std::vector<Detection> haar = fd.cv_detect_all(img);
+    ASSERT_FALSE(haar.empty());
+    EXPECT_EQ(-1, haar[0].weight_index);
+
+    fd.set_score_threshold(d.score + 1);
+    EXPECT_TRUE(fd.dlib_detect_all(img).empty());
+
+    // set_min_face_size() also picks the scale, which is reset so that only
+    // the size filter can drop the face
+    fd.set_score_threshold(0);
+    fd.set_min_face_size(d.rect.width());
+    fd.set_scale(1);
+    std::vector<Detection> ds = fd.dlib_detect_all(img);
+    ASSERT_FALSE(ds.empty());
+    for (size_t i = 0; i < ds.size(); i++)
+        EXPECT_GE(ds[i].rect.width(), d.rect.width());
+
+    fd.set_min_face_size(d.rect.width() + 1);
+    fd.set_scale(1);
+    ds = fd.dlib_detect_all(img);
+    for (size_t i = 0; i < ds.size(); i++)
+        EXPECT_GE(ds[i].rect.width(), d.rect.width() + 1);
+}
+
+/**
+ * @fn non_max_suppression()
+ *
+ * @test
+ * Of two overlapping detections the one with the higher score is kept,
+ * disjoint detections are not affected.
+ */
+TEST (NonMaxSuppressionTest, KeepsStrongestDetection) {
+    std::vector<Detection> ds(3);
+    ds[0].rect = Rectangle(0, 0, 100, 100);
+    ds[0].score = 0.5;
+    ds[1].rect = Rectangle(10, 10, 100, 100);
+    ds[1].score = 1.5;
+    ds[2].rect = Rectangle(300, 300, 100, 100);
+    ds[2].score = 0.1;
+
+    std::vector<Detection> kept = non_max_suppression(ds, 0.5);
+
+    ASSERT_EQ(2u, kept.size());
+    EXPECT_EQ(1.5, kept[0].score);
+    EXPECT_EQ(0.1, kept[1].score);
+}
+
+/**
+ * @fn FaceDetector::detect_all(const PreparedImage&)
+ *
+ * @test
+ * Scanning the shared pyramid level by level finds the same face as the
+ * detector's own pyramid in every mode, also when HOG_PARALLEL spreads the
+ * levels over threads. The results refer to the color frame of the
+ * PreparedImage.
+ */
+TEST_F (FaceDetectorTest, DetectPrepared) {
+    PreparedImage prepared(img);
+    ASSERT_LT(1u, prepared.levels());
+    EXPECT_EQ(img.width(), prepared.gray().nc());
+    EXPECT_EQ(img.height(), prepared.gray().nr());
+
+    Detection expected = fd.dlib_detect(img);
+    ASSERT_LT(0, expected.rect.area());
+
+    fd.set_threads(3);
+    const DetectionMode modes[] = {HOG, HOG_PARALLEL, HAAR, CASCADE};
+    for (size_t i = 0; i < 4; i++) {
+        fd.set_mode(modes[i]);
+        std::vector<Detection> ds = fd.detect_all(prepared);
+        ASSERT_FALSE(ds.empty()) << "mode " << modes[i];
+        EXPECT_GT(ds[0].rect.iou(expected.rect), 0.5) << "mode " << modes[i];
+        EXPECT_EQ(img.width(), ds[0].face.width());
+    }
+
+    fd.set_mode(HOG);
+    std::vector<Detection> serial = fd.detect_all(prepared);
+    fd.set_mode(HOG_PARALLEL);
+    std::vector<Detection> parallel = fd.detect_all(prepared);
+    ASSERT_EQ(serial.size(), parallel.size());
+    for (size_t i = 0; i < serial.size(); i++) {
+        EXPECT_EQ(serial[i].rect.asDLIBRect(), parallel[i].rect.asDLIBRect());
+        EXPECT_DOUBLE_EQ(serial[i].score, parallel[i].score);
+    }
+
+    fd.set_mode(HOG);
+    EXPECT_TRUE(fd.detect_all(PreparedImage(noFace)).empty());
+}
+
+/**
+ * @fn FaceDetector::dlib_parallel_detect_all()
+ *
+ * @test
+ * Scanning the pyramid levels on several threads yields exactly the
+ * detections of dlib's serial scan, also on a downscaled image.
+ */
+TEST_F (FaceDetectorTest, ParallelPyramidDetect) {
+    fd.set_threads(4);
+    const double scales[] = {1., 0.5};
+    for (size_t s = 0; s < 2; s++) {
+        fd.set_scale(scales[s]);
+        std::vector<Detection> serial = fd.dlib_detect_all(img);
+        std::vector<Detection> parallel = fd.dlib_parallel_detect_all(img);
+
+        ASSERT_FALSE(serial.empty());
+        ASSERT_EQ(serial.size(), parallel.size());
+        for (size_t i = 0; i < serial.size(); i++) {
+            EXPECT_EQ(serial[i].rect.asDLIBRect(), parallel[i].rect.asDLIBRect());
+            EXPECT_DOUBLE_EQ(serial[i].score, parallel[i].score);
+            EXPECT_EQ(serial[i].weight_index, parallel[i].weight_index);
+        }
+    }
+
+    fd.set_mode(HOG_PARALLEL);
+    EXPECT_TRUE(fd.detect_all(noFace).empty());
+}
+
 // TODO(Jan): Add test for multiple detections and difficult cases(glasses, extreme angle)
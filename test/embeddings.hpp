@@ -0,0 +1,52 @@
+#ifndef EMBEDDINGS_HPP
+#define EMBEDDINGS_HPP
+
+#include "openface/neuralnetwork.hpp"
+
+#include <dlib/matrix.h>
+#include <dlib/rand.h>
+#include <vector>
+
+//! @cond HIDDEN_SYMBOLS
+/**
+ * Generators of synthetic FaceNet embeddings shared by the tests and the
+ * benchmarks, which need thousands of embeddings without running the network.
+ */
+
+/**
+ * Returns #n random embeddings of unit length, like the ones of the network.
+ */
+inline std::vector<FaceNetEmbed> random_embeddings(size_t n, unsigned long seed = 0) {
+    dlib::rand rnd(seed);
+    std::vector<FaceNetEmbed> out(n);
+    for (size_t i = 0; i < n; i++) {
+        for (long j = 0; j < out[i].size(); j++)
+            out[i](j) = rnd.get_random_gaussian();
+        out[i] /= dlib::length(out[i]);
+    }
+    return out;
+}
+
+/**
+ * Returns #n noisy samples of random identities, like embeddings of a gallery.
+ *
+ * Unlike uniformly random vectors these have close neighbours, like a gallery
+ * with several photos per person. The identities are drawn from #seed, the
+ * samples from #noise_seed, so another #noise_seed gives new photos of the
+ * same people.
+ */
+inline std::vector<FaceNetEmbed> identity_embeddings(size_t n, size_t identities, unsigned long seed = 0, unsigned long noise_seed = 1) {
+    std::vector<FaceNetEmbed> centers = random_embeddings(identities, seed);
+    dlib::rand rnd(noise_seed);
+    std::vector<FaceNetEmbed> out(n);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = centers[rnd.get_random_64bit_number() % identities];
+        for (long j = 0; j < out[i].size(); j++)
+            out[i](j) += 0.05 * rnd.get_random_gaussian();
+        out[i] /= dlib::length(out[i]);
+    }
+    return out;
+}
+//! @endcond
+
+#endif
@@ -0,0 +1,22 @@
+require 'torch'
+
+torch.setdefaulttensortype('torch.FloatTensor')
+
+-- Stand-in for forward_nn.lua that skips the network, used to test the
+-- C++/lua bridge without loading nn4.v2.t7.
+rep = torch.Tensor()
+
+function load(path)
+end
+
+function set_num_threads(n)
+end
+
+function forward_nn_batch(data)
+    local n = data:size(1)
+    rep:resize(n, 128)
+    for i = 1, n do
+        rep[i]:fill(data[i]:mean())
+    end
+    return(rep)
+end
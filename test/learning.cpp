@@ -1,7 +1,21 @@
 #include "learning/facerecognizer.hpp"
+#include "learning/identitytracker.hpp"
+#include "learning/embeddingindex.hpp"
+#include "learning/distance.hpp"
+#include "learning/productquantizer.hpp"
+#include "learning/linearscorer.hpp"
+#include "embeddings.hpp"
 #include <dlib/matrix.h>
+#include <dlib/rand.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
 //! @cond HIDDEN_SYMBOLS
 class FaceRecognizerTest : public ::testing::Test {
 protected:
@@ -25,4 +39,457 @@ TEST_F (FaceRecognizerTest, RecognizeFace) {
 
     EXPECT_EQ(recognition.first, "Jan");
 }
+
+/**
+ * @fn IdentityTracker::update()
+ *
+ * @test
+ * A still face is only embedded every reembed_interval() frames and keeps
+ * its label, a changed crop is embedded right away.
+ */
+TEST_F (FaceRecognizerTest, IdentityTrackerReusesRecognition) {
+    OpenFace of(FACE_SHAPE, FORWARD_DEFINITION, NEURAL_NETWORK);
+    FaceDetector fd;
+    IdentityTracker identities(of, fr, 10);
+
+    Image img("test/resources/image.jpg");
+    std::vector<Track> tracks(1);
+    tracks[0].id = 0;
+    tracks[0].detection = fd.dlib_detect(img);
+    tracks[0].confidence = 0;
+
+    std::string label = identities.update(tracks)[0].label;
+    for (int i = 1; i < 30; i++) {
+        std::vector<Identity> ids = identities.update(tracks);
+        ASSERT_EQ(1u, ids.size());
+        EXPECT_EQ(label, ids[0].label);
+        EXPECT_EQ(i % 10 == 0, ids[0].embedded);
+    }
+    EXPECT_EQ(3u, identities.embeddings());
+
+    Rectangle r = tracks[0].detection.rect;
+    tracks[0].detection.rect = Rectangle(r.x() + r.width()/2, r.y(), r.width(), r.height());
+    EXPECT_TRUE(identities.update(tracks)[0].embedded);
+}
+
 TEST (RecognizerTest, DISABLED_SavingAndLoadingFromFile) {}
+
+/**
+ * @fn squared_distances()
+ *
+ * @test
+ * All kernels supported by the CPU compute the distances of the scalar loop,
+ * up to the order of the summation, also for sizes without full registers.
+ */
+TEST (DistanceTest, SimdKernels) {
+    typedef void (*Kernel)(const float*, const float*, size_t, size_t, float*);
+    Kernel kernels[] = {squared_distances_scalar, squared_distances_avx2, squared_distances_avx512};
+    const char* isas[] = {"scalar", "avx2", "avx512f"};
+
+    std::vector<FaceNetEmbed> es = random_embeddings(17);
+    const size_t dims[] = {EMBEDDING_DIMS, 37};
+    for (size_t d = 0; d < 2; d++) {
+        std::vector<float> rows;
+        for (size_t i = 1; i < es.size(); i++)
+            rows.insert(rows.end(), &es[i](0), &es[i](0) + dims[d]);
+        const size_t n = rows.size() / dims[d];
+
+        std::vector<float> expected(n);
+        squared_distances_scalar(&es[0](0), rows.data(), n, dims[d], expected.data());
+        for (size_t k = 0; k < 3; k++) {
+            if (!squared_distances_supported(isas[k]))
+                continue;
+            std::vector<float> out(n);
+            kernels[k](&es[0](0), rows.data(), n, dims[d], out.data());
+            for (size_t i = 0; i < n; i++)
+                EXPECT_NEAR(expected[i], out[i], 1e-5) << isas[k];
+        }
+    }
+}
+
+/**
+ * @fn dot_products()
+ *
+ * @test
+ * All kernels supported by the CPU compute the same dot products.
+ */
+TEST (DistanceTest, DotProductKernels) {
+    typedef void (*Kernel)(const float*, const float*, size_t, size_t, float*);
+    Kernel kernels[] = {dot_products_scalar, dot_products_avx2, dot_products_avx512};
+    const char* isas[] = {"scalar", "avx2", "avx512f"};
+
+    std::vector<FaceNetEmbed> es = random_embeddings(17);
+    const size_t dims[] = {EMBEDDING_DIMS, 37};
+    for (size_t d = 0; d < 2; d++) {
+        std::vector<float> rows;
+        for (size_t i = 1; i < es.size(); i++)
+            rows.insert(rows.end(), &es[i](0), &es[i](0) + dims[d]);
+        const size_t n = rows.size() / dims[d];
+
+        std::vector<float> expected(n);
+        dot_products_scalar(&es[0](0), rows.data(), n, dims[d], expected.data());
+        for (size_t k = 0; k < 3; k++) {
+            if (!squared_distances_supported(isas[k]))
+                continue;
+            std::vector<float> out(n);
+            kernels[k](&es[0](0), rows.data(), n, dims[d], out.data());
+            for (size_t i = 0; i < n; i++)
+                EXPECT_NEAR(expected[i], out[i], 1e-5) << isas[k];
+        }
+    }
+}
+
+/**
+ * @fn BruteForceIndex::search()
+ *
+ * @test
+ * The neighbours equal those of sorting all distances, no matter how many
+ * threads scan the shards.
+ */
+TEST (EmbeddingIndexTest, BruteForceSearch) {
+    std::vector<FaceNetEmbed> es = random_embeddings(20000);
+    std::vector<FaceNetEmbed> queries = random_embeddings(5, 1);
+    BruteForceIndex index;
+    index.add(es);
+    ASSERT_EQ(es.size(), index.size());
+    EXPECT_EQ(0u, reinterpret_cast<size_t>(index.embedding(0)) % 64);
+
+    for (size_t q = 0; q < queries.size(); q++) {
+        std::vector<Neighbor> expected(es.size());
+        for (size_t i = 0; i < es.size(); i++)
+            expected[i] = Neighbor(i, dlib::length_squared(es[i] - queries[q]));
+        std::sort(expected.begin(), expected.end());
+
+        for (int threads = 1; threads <= 4; threads *= 2) {
+            index.set_threads(threads);
+            std::vector<Neighbor> found = index.search(queries[q], 10);
+            ASSERT_EQ(10u, found.size());
+            for (size_t i = 0; i < found.size(); i++) {
+                EXPECT_EQ(expected[i].id, found[i].id);
+                EXPECT_NEAR(expected[i].distance, found[i].distance, 1e-5);
+            }
+        }
+    }
+    EXPECT_EQ(es.size(), index.search(queries[0], es.size() + 1).size());
+}
+
+/**
+ * @fn FaceRecognizer::set_index()
+ *
+ * @test
+ * With an index a face is recognized by its nearest neighbours, a new person
+ * is known right after add() and a face far from all others is unknown.
+ */
+TEST (RecognizerTest, NearestNeighborRecognition) {
+    FaceNetEmbed jan;
+    dlib::deserialize("test/resources/Jan.dat") >> jan;
+    std::vector<FaceNetEmbed> others = random_embeddings(100);
+
+    FaceRecognizer fr;
+    fr.set_index(std::make_shared<BruteForceIndex>());
+    fr.train(others, std::vector<std::string>(others.size(), "other"));
+    fr.set_neighbors(1);
+
+    EXPECT_EQ(FaceRecognizer::UNKNOWN, fr.recognize(jan).first);
+    fr.add(jan, "Jan");
+    std::pair<std::string, float> r = fr.recognize(jan);
+    EXPECT_EQ("Jan", r.first);
+    EXPECT_EQ(1.f, r.second);
+
+    fr.set_max_distance(0.01);
+    EXPECT_EQ(FaceRecognizer::UNKNOWN, fr.recognize(-others[0]).first);
+}
+
+/**
+ * @fn FaceRecognizer::recognize()
+ *
+ * @test
+ * A tie between the neighbours goes to the label of the nearest one, and the
+ * probability only counts the neighbours within max_distance().
+ */
+TEST (RecognizerTest, NearestNeighborVotes) {
+    // Neighbours B, A, A, B by increasing distance and C beyond max_distance()
+    const float angles[] = {0.1f, 0.2f, 0.3f, 0.4f};
+    const char* names[] = {"B", "A", "A", "B"};
+    std::vector<FaceNetEmbed> faces;
+    std::vector<std::string> labels;
+    for (int i = 0; i < 4; i++) {
+        FaceNetEmbed e = dlib::zeros_matrix<float>(128, 1);
+        e(0) = std::cos(angles[i]);
+        e(1) = std::sin(angles[i]);
+        faces.push_back(e);
+        labels.push_back(names[i]);
+    }
+    FaceNetEmbed query = dlib::zeros_matrix<float>(128, 1);
+    query(0) = 1;
+    faces.push_back(-query);
+    labels.push_back("C");
+
+    FaceRecognizer fr;
+    fr.set_index(std::make_shared<BruteForceIndex>());
+    fr.train(faces, labels);
+    fr.set_neighbors(5);
+
+    std::pair<std::string, float> r = fr.recognize(query);
+    EXPECT_EQ("B", r.first);
+    EXPECT_FLOAT_EQ(0.5f, r.second);
+}
+
+/**
+ * @fn HNSWIndex::search()
+ *
+ * @test
+ * The graph finds most of the exact nearest neighbours of a gallery, more
+ * with a larger ef, and a saved index answers queries like the original.
+ * Corrupt files are rejected without changing the index.
+ */
+TEST (EmbeddingIndexTest, HNSWRecall) {
+    std::vector<FaceNetEmbed> es = identity_embeddings(5000, 500);
+    // Other photos of the people in the gallery
+    std::vector<FaceNetEmbed> queries = identity_embeddings(50, 500, 0, 7);
+    BruteForceIndex exact;
+    exact.add(es);
+    HNSWIndex index(8, 100);
+    index.set_threads(4);
+    index.add(es);
+    ASSERT_EQ(es.size(), index.size());
+
+    double recall[2] = {0, 0};
+    const size_t efs[2] = {10, 100};
+    for (size_t e = 0; e < 2; e++) {
+        index.set_ef(efs[e]);
+        for (size_t q = 0; q < queries.size(); q++) {
+            std::vector<Neighbor> expected = exact.search(queries[q], 10);
+            std::vector<Neighbor> found = index.search(queries[q], 10);
+            ASSERT_EQ(10u, found.size());
+            EXPECT_TRUE(std::is_sorted(found.begin(), found.end()));
+            for (size_t i = 0; i < found.size(); i++) {
+                for (size_t j = 0; j < expected.size(); j++)
+                    recall[e] += found[i].id == expected[j].id;
+            }
+        }
+        recall[e] /= 10 * queries.size();
+    }
+    EXPECT_GT(recall[1], 0.95);
+    EXPECT_GE(recall[1], recall[0]);
+
+    index.save("test/resources/hnsw.idx");
+    HNSWIndex loaded;
+    loaded.load("test/resources/hnsw.idx");
+
+    // A truncated file is rejected and leaves the loaded index intact
+    std::ifstream saved("test/resources/hnsw.idx", std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(saved)), std::istreambuf_iterator<char>());
+    std::ofstream("test/resources/hnsw_truncated.idx", std::ios::binary) << bytes.substr(0, bytes.size() - 4);
+    EXPECT_THROW(loaded.load("test/resources/hnsw_truncated.idx"), std::runtime_error);
+    std::remove("test/resources/hnsw_truncated.idx");
+    std::remove("test/resources/hnsw.idx");
+    ASSERT_EQ(index.size(), loaded.size());
+    EXPECT_EQ(index.ef(), loaded.ef());
+    for (size_t q = 0; q < queries.size(); q++) {
+        std::vector<Neighbor> a = index.search(queries[q], 5);
+        std::vector<Neighbor> b = loaded.search(queries[q], 5);
+        ASSERT_EQ(a.size(), b.size());
+        for (size_t i = 0; i < a.size(); i++)
+            EXPECT_EQ(a[i].id, b[i].id);
+    }
+    EXPECT_THROW(loaded.load("test/resources/Jan.dat"), std::runtime_error);
+    EXPECT_EQ(index.size(), loaded.size());
+}
+
+/**
+ * @fn HNSWIndex::add(const FaceNetEmbed&)
+ *
+ * @test
+ * Embeddings inserted one at a time into a FaceRecognizer backed by the
+ * graph are found right away.
+ */
+TEST (RecognizerTest, HNSWRecognition) {
+    std::vector<FaceNetEmbed> es = random_embeddings(300);
+    std::shared_ptr<HNSWIndex> index = std::make_shared<HNSWIndex>();
+    index->set_ef(100);
+    FaceRecognizer fr;
+    fr.set_index(index);
+    fr.set_neighbors(1);
+    for (size_t i = 0; i < es.size(); i++) {
+        fr.add(es[i], std::to_string(i));
+        EXPECT_EQ(std::to_string(i), fr.recognize(es[i]).first);
+    }
+    EXPECT_EQ(es.size(), fr.labels().size());
+}
+
+/**
+ * @fn ProductQuantizer::distance_table()
+ *
+ * @test
+ * A code takes one byte per subspace and the distance from the lookup table
+ * equals the distance to the decoded embedding. A saved quantizer encodes
+ * like the original.
+ */
+TEST (ProductQuantizerTest, EncodeAndDistance) {
+    std::vector<FaceNetEmbed> es = identity_embeddings(3000, 300);
+    ProductQuantizer pq(16);
+    EXPECT_THROW(pq.train(std::vector<FaceNetEmbed>(es.begin(), es.begin() + 100)), std::runtime_error);
+    pq.train(es, 10);
+    ASSERT_TRUE(pq.trained());
+
+    std::vector<float> table(pq.subspaces() * ProductQuantizer::CENTROIDS);
+    pq.distance_table(es[0], table.data());
+    for (size_t i = 0; i < 100; i++) {
+        uint8_t code[16];
+        pq.encode(es[i], code);
+        FaceNetEmbed decoded = pq.decode(code);
+        EXPECT_LT(dlib::length_squared(decoded - es[i]), 0.5);
+        EXPECT_NEAR(dlib::length_squared(decoded - es[0]), pq.distance(table.data(), code), 1e-4);
+    }
+
+    pq.save("test/resources/pq.dat");
+    ProductQuantizer loaded(32);
+    loaded.load("test/resources/pq.dat");
+    std::remove("test/resources/pq.dat");
+    ASSERT_EQ(pq.subspaces(), loaded.subspaces());
+    for (size_t i = 0; i < 100; i++) {
+        uint8_t a[16], b[16];
+        pq.encode(es[i], a);
+        loaded.encode(es[i], b);
+        EXPECT_EQ(0, memcmp(a, b, sizeof(a)));
+    }
+    EXPECT_THROW(loaded.load("test/resources/Jan.dat"), std::runtime_error);
+    EXPECT_THROW(ProductQuantizer(24), std::runtime_error);
+}
+
+/**
+ * @fn PQIndex::search()
+ *
+ * @test
+ * The codes take a 32nd of the memory of the floats and find the nearest
+ * embedding of most queries. Reranking from the vector file returns the
+ * exact distances and the exact nearest neighbour.
+ */
+TEST (EmbeddingIndexTest, PQSearch) {
+    std::vector<FaceNetEmbed> es = identity_embeddings(3000, 300);
+    ProductQuantizer pq(16);
+    pq.train(es, 10);
+    BruteForceIndex exact;
+    exact.add(es);
+    PQIndex compressed(pq);
+    compressed.add(es);
+    PQIndex reranked(pq, "test/resources/pq_vectors.dat");
+    reranked.add(es);
+    ASSERT_EQ(es.size(), compressed.size());
+    EXPECT_EQ(es.size() * EMBEDDING_DIMS * sizeof(float), 32 * compressed.code_bytes());
+
+    dlib::rand rnd(9);
+    size_t top1 = 0;
+    for (size_t q = 0; q < 50; q++) {
+        FaceNetEmbed query = es[q * 10];
+        for (long j = 0; j < query.size(); j++)
+            query(j) += 0.01 * rnd.get_random_gaussian();
+        std::vector<Neighbor> expected = exact.search(query, 10);
+        std::vector<Neighbor> approximate = compressed.search(query, 10);
+        std::vector<Neighbor> found = reranked.search(query, 10);
+        ASSERT_EQ(10u, approximate.size());
+        ASSERT_EQ(10u, found.size());
+        EXPECT_TRUE(std::is_sorted(found.begin(), found.end()));
+        top1 += approximate[0].id == expected[0].id;
+        EXPECT_EQ(expected[0].id, found[0].id);
+        for (size_t i = 0; i < found.size(); i++) {
+            float d = dlib::length_squared(es[found[i].id] - query);
+            EXPECT_NEAR(d, found[i].distance, 1e-4);
+        }
+    }
+    EXPECT_GE(top1, 45u);
+    std::remove("test/resources/pq_vectors.dat");
+}
+
+/**
+ * @fn PQIndex::save()
+ *
+ * @test
+ * A saved index reopened with its vector file returns the same neighbours
+ * and keeps appending to the file. A vector file of another size or a
+ * truncated index are refused.
+ */
+TEST (EmbeddingIndexTest, PQSaveAndReopen) {
+    std::vector<FaceNetEmbed> es = identity_embeddings(3000, 300);
+    ProductQuantizer pq(16);
+    pq.train(es, 10);
+    {
+        PQIndex index(pq, "test/resources/pq_reopen.dat");
+        index.add(std::vector<FaceNetEmbed>(es.begin(), es.begin() + 2000));
+        index.save("test/resources/pq_reopen.idx");
+    }
+
+    PQIndex reopened("test/resources/pq_reopen.idx", "test/resources/pq_reopen.dat");
+    ASSERT_EQ(2000u, reopened.size());
+    reopened.add(std::vector<FaceNetEmbed>(es.begin() + 2000, es.end()));
+    PQIndex fresh(pq, "test/resources/pq_fresh.dat");
+    fresh.add(es);
+    for (size_t q = 0; q < 30; q++) {
+        std::vector<Neighbor> expected = fresh.search(es[q * 100], 10);
+        std::vector<Neighbor> found = reopened.search(es[q * 100], 10);
+        ASSERT_EQ(expected.size(), found.size());
+        for (size_t i = 0; i < found.size(); i++) {
+            EXPECT_EQ(expected[i].id, found[i].id);
+            EXPECT_FLOAT_EQ(expected[i].distance, found[i].distance);
+        }
+    }
+
+    EXPECT_THROW(PQIndex("test/resources/pq_reopen.idx", "test/resources/pq_fresh.dat"), std::runtime_error);
+    std::ifstream in("test/resources/pq_reopen.idx", std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream("test/resources/pq_truncated.idx", std::ios::binary).write(bytes.data(), bytes.size() - 100);
+    EXPECT_THROW(reopened.load("test/resources/pq_truncated.idx"), std::runtime_error);
+    EXPECT_EQ(es.size(), reopened.size());
+    EXPECT_THROW(reopened.load("test/resources/pq_reopen.idx"), std::runtime_error);
+    EXPECT_EQ(es.size(), reopened.size());
+
+    std::remove("test/resources/pq_truncated.idx");
+    std::remove("test/resources/pq_reopen.idx");
+    std::remove("test/resources/pq_reopen.dat");
+    std::remove("test/resources/pq_fresh.dat");
+}
+
+/**
+ * @fn LinearScorer::classify()
+ *
+ * @test
+ * The compiled SVM predicts the labels and probabilities of the decision
+ * function it was compiled from, for single faces and for a batch.
+ */
+TEST (RecognizerTest, LinearScorer) {
+    const size_t identities = 8;
+    std::vector<FaceNetEmbed> es = identity_embeddings(400, identities);
+    std::vector<FaceNetEmbed> centers = random_embeddings(identities);
+    std::vector<std::string> labels(es.size());
+    for (size_t i = 0; i < es.size(); i++) {
+        size_t nearest = 0;
+        for (size_t c = 1; c < identities; c++) {
+            if (dlib::length_squared(es[i] - centers[c]) < dlib::length_squared(es[i] - centers[nearest]))
+                nearest = c;
+        }
+        labels[i] = std::to_string(nearest);
+    }
+
+    FaceRecognizer fr;
+    fr.train(es, labels);
+    ova_decision_function df = fr.df();
+    LinearScorer scorer(df);
+    ASSERT_EQ(identities, scorer.classes());
+    EXPECT_THROW(LinearScorer().classify(es[0]), std::runtime_error);
+
+    std::vector<FaceNetEmbed> queries = random_embeddings(20, 3);
+    queries.insert(queries.end(), es.begin(), es.begin() + 20);
+    std::vector<std::pair<std::string, float> > batch = scorer.predict(queries);
+    std::vector<std::pair<std::string, float> > recognized = fr.recognize(queries);
+    ASSERT_EQ(queries.size(), batch.size());
+    for (size_t q = 0; q < queries.size(); q++) {
+        std::pair<std::string, float> expected = df.predict(queries[q]);
+        std::pair<std::string, float> single = scorer.predict(queries[q]);
+        EXPECT_EQ(expected.first, single.first);
+        EXPECT_NEAR(expected.second, single.second, 1e-4);
+        EXPECT_EQ(expected.first, batch[q].first);
+        EXPECT_NEAR(expected.second, batch[q].second, 1e-4);
+        EXPECT_EQ(expected.first, recognized[q].first);
+    }
+}
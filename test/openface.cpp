@@ -1,10 +1,19 @@
 #include "openface/torchinterface.hpp"
 #include "openface/neuralnetwork.hpp"
+#include "openface/neuralnetworkpool.hpp"
+#include "openface/pixelconversion.hpp"
 #include "openface/face.hpp"
 #include "openface/facealigner.hpp"
 #include "detection/facedetector.hpp"
 #include <gtest/gtest.h>
 
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <sys/resource.h>
+
 //! @cond HIDDEN_SYMBOLS
 class FaceTest : public ::testing::Test {
 protected:
@@ -36,6 +45,116 @@ TEST_F(FaceTest, TestFaceAlignment) {
     EXPECT_EQ(r.face.height(), FACE_SIZE_CONSTRAINT);
 }
 
+/**
+ * @fn FaceAligner::align(const Detection&, float*)
+ *
+ * @test
+ * Aligning straight into planar floats matches aligning into an Image and
+ * converting that to a Tensor, up to the 8-bit rounding of the latter.
+ */
+TEST_F(FaceTest, TestFusedFaceAlignment) {
+    const int n = FACE_SIZE_CONSTRAINT * FACE_SIZE_CONSTRAINT;
+    std::vector<float> fused(3*n);
+    aligner.align(r, fused.data());
+
+    aligner.align(r);
+    Tensor expected(r.face);
+    const float* data = TensorData(expected.raw());
+
+    double diff = 0;
+    for (int i = 0; i < 3*n; i++) {
+        diff += std::abs(fused[i] - data[i]);
+    }
+    EXPECT_LT(diff / (3*n), 1./255);
+}
+
+/**
+ * @fn FaceAligner::align(const PreparedImage&, const Detection&, float*)
+ *
+ * @test
+ * The shape predictor works on intensities, so predicting the landmarks on
+ * the prepared grayscale frame aligns the face like the color frame does.
+ */
+TEST_F(FaceTest, TestPreparedFaceAlignment) {
+    const int n = FACE_SIZE_CONSTRAINT * FACE_SIZE_CONSTRAINT;
+    std::vector<float> color(3*n), prepared(3*n);
+    aligner.align(r, color.data());
+
+    PreparedImage img(r.face);
+    aligner.align(img, r, prepared.data());
+
+    double diff = 0;
+    for (int i = 0; i < 3*n; i++) {
+        diff += std::abs(color[i] - prepared[i]);
+    }
+    EXPECT_LT(diff / (3*n), 1./255);
+}
+
+/**
+ * @fn FaceAligner::align(std::vector<Detection>&)
+ *
+ * @test
+ * Aligning a set of faces on several threads yields the faces of the serial
+ * alignment in the order of the input, both as Images and as floats, also
+ * for a part of the set passed as pointer and count.
+ */
+TEST_F(FaceTest, TestParallelFaceAlignment) {
+    const int n = 3 * FACE_SIZE_CONSTRAINT * FACE_SIZE_CONSTRAINT;
+    std::vector<Detection> ds(8, r);
+    for (size_t i = 0; i < ds.size(); i++) {
+        const Rectangle& rect = r.rect;
+        ds[i].rect = Rectangle(rect.x() + i, rect.y() - i, rect.width() + 2*i, rect.height());
+    }
+
+    aligner.set_threads(4);
+    std::vector<float> fused(ds.size() * n);
+    aligner.align(ds, fused.data());
+
+    std::vector<Detection> aligned = ds;
+    aligner.align(aligned);
+
+    // A part of the detections is aligned like the same faces of the whole set
+    std::vector<float> part(3 * n);
+    aligner.align(ds.data() + 2, 3, part.data());
+    EXPECT_TRUE(std::equal(part.begin(), part.end(), fused.begin() + 2*n));
+
+    aligner.set_threads(1);
+    for (size_t i = 0; i < ds.size(); i++) {
+        std::vector<float> expected(n);
+        aligner.align(ds[i], expected.data());
+        EXPECT_TRUE(std::equal(expected.begin(), expected.end(), fused.begin() + i*n));
+
+        Detection serial = ds[i];
+        aligner.align(serial);
+        EXPECT_EQ(0, cv::norm(serial.face.asConstCVImage(), aligned[i].face.asConstCVImage(), cv::NORM_INF));
+    }
+}
+
+/**
+ * @fn FaceAligner::load()
+ *
+ * @test
+ * The 5 point model maps the face onto the same template as the 68 point
+ * model, up to a few pixels of the aligned face.
+ */
+TEST_F(FaceTest, TestFivePointFaceAlignment) {
+    FaceAligner fast(FACE_SHAPE_5);
+    EXPECT_EQ(5u, fast.num_parts());
+    EXPECT_EQ(68u, aligner.num_parts());
+
+    cv::Mat inv;
+    cv::invertAffineTransform(aligner.transformation(r), inv);
+    std::vector<cv::Point2f> points(OUTER_EYES_AND_NOSE, OUTER_EYES_AND_NOSE + 3);
+    cv::transform(points, points, inv);
+    cv::transform(points, points, fast.transformation(r));
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_LT(cv::norm(points[i] - OUTER_EYES_AND_NOSE[i]), 4);
+    }
+
+    fast.align(r);
+    EXPECT_EQ(FACE_SIZE_CONSTRAINT, r.face.width());
+}
+
 //TODO(Jan): Add a test for alignment impossible
 
 /**
@@ -59,8 +178,166 @@ TEST (NeuralNetworkTest, NeuralNetworkForward) {
     EXPECT_NEAR(rep(4), -0.06, 0.01);
 }
 
+/**
+ * @fn NeuralNetwork::NeuralNetwork(const std::string)
+ *
+ * @test
+ * The native C++ backend reproduces the output of the python implementation
+ * of OpenFace, like the torch backend.
+ */
+TEST (NeuralNetworkTest, NativeNeuralNetworkForward) {
+    NeuralNetwork nn(NATIVE_NEURAL_NETWORK);
+    Image img("test/resources/face.png");
+    Face face(img, true);
+    FaceNetEmbed rep = nn.forward_nn(face);
+
+    EXPECT_TRUE(nn.native());
+    EXPECT_NEAR(rep(0), -0.07, 0.01);
+    EXPECT_NEAR(rep(1), -0.01, 0.01);
+    EXPECT_NEAR(rep(2), -0.03, 0.01);
+    EXPECT_NEAR(rep(3), 0.08, 0.01);
+    EXPECT_NEAR(rep(4), -0.06, 0.01);
+}
+
+/**
+ * @fn NeuralNetwork::set_quantized()
+ *
+ * @test
+ * The int8 mode calibrated on a face stays close to the float embedding and
+ * releases the float weights, so it needs less memory.
+ */
+TEST (NeuralNetworkTest, QuantizedNeuralNetworkForward) {
+    NeuralNetwork nn(NATIVE_NEURAL_NETWORK);
+    Image img("test/resources/face.png");
+    FaceNetEmbed expected = nn.forward_nn(img);
+    size_t float_bytes = nn.weight_bytes();
+
+    EXPECT_THROW(nn.set_quantized(true), std::runtime_error);
+    nn.calibrate(std::vector<Image>(1, img));
+    nn.set_quantized(true);
+    FaceNetEmbed rep = nn.forward_nn(img);
+
+    EXPECT_GT(dlib::dot(rep, expected), 0.99);
+    EXPECT_LT(nn.weight_bytes(), float_bytes / 3);
+    EXPECT_THROW(nn.set_quantized(false), std::runtime_error);
+}
+
+/**
+ * @fn NeuralNetwork::forward_nn(const std::vector<Image>&)
+ *
+ * @test
+ * Batched forwarding gives the same embeddings as forwarding each face alone,
+ * also when the faces do not fill up the last batch.
+ */
+TEST (NeuralNetworkTest, NeuralNetworkBatchForward) {
+    NeuralNetwork nn("src/openface/forward_nn.lua", "resources/nn4.v2.t7");
+    nn.set_batch_size(2);
+    Image img("test/resources/face.png");
+    std::vector<Image> faces(3, img);
+
+    FaceNetEmbed single = nn.forward_nn(img);
+    std::vector<FaceNetEmbed> reps = nn.forward_nn(faces);
+
+    ASSERT_EQ(reps.size(), faces.size());
+    for (size_t i = 0; i < reps.size(); i++) {
+        EXPECT_NEAR(dlib::max(dlib::abs(reps[i] - single)), 0, 1e-5);
+    }
+}
+
+/**
+ * @fn NeuralNetworkPool::forward_nn()
+ *
+ * @test
+ * Forwarding from several threads at once through a pool gives the same
+ * embeddings as a single network.
+ */
+TEST (NeuralNetworkPoolTest, ConcurrentForward) {
+    NeuralNetwork nn("src/openface/forward_nn.lua", "resources/nn4.v2.t7");
+    NeuralNetworkPool pool("src/openface/forward_nn.lua", "resources/nn4.v2.t7", 2);
+    Image img("test/resources/face.png");
+    FaceNetEmbed expected = nn.forward_nn(img);
+
+    std::vector<FaceNetEmbed> reps(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < reps.size(); i++) {
+        threads.push_back(std::thread([&, i]() { reps[i] = pool.forward_nn(img); }));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    for (size_t i = 0; i < reps.size(); i++) {
+        EXPECT_NEAR(dlib::max(dlib::abs(reps[i] - expected)), 0, 1e-5);
+    }
+}
+
+/**
+ * @fn NeuralNetwork::forward_nn()
+ *
+ * @test
+ * Memory stays flat over 100k forwards, so neither the input tensors nor the
+ * tensors returned from lua leak. Uses a stub script instead of the network.
+ */
+TEST (NeuralNetworkTest, SteadyStateMemory) {
+    NeuralNetwork nn("test/forward_stub.lua", "");
+    Image img("test/resources/face.png");
+    struct rusage usage;
+
+    for (int i = 0; i < 1000; i++) {
+        nn.forward_nn(img);
+    }
+    getrusage(RUSAGE_SELF, &usage);
+    long before = usage.ru_maxrss;
+
+    for (int i = 0; i < 100000; i++) {
+        nn.forward_nn(img);
+    }
+    getrusage(RUSAGE_SELF, &usage);
+    long after = usage.ru_maxrss;
+
+    EXPECT_LT(after, before * 1.1);
+}
+
 // TODO(Jan): Add test for unaligned face.
 
+/**
+ * @fn bgr_to_planar_rgb()
+ *
+ * @test
+ * Every available kernel produces bit-exactly the output of the original
+ * double precision loop, including pixel counts that are not a multiple of
+ * the vector width.
+ */
+TEST (PixelConversionTest, BitExactKernels) {
+    typedef void (*Kernel)(const unsigned char*, size_t, float*, float*, float*);
+    const char* isas[] = {"scalar", "sse4.1", "avx2"};
+    Kernel kernels[] = {bgr_to_planar_rgb_scalar, bgr_to_planar_rgb_sse, bgr_to_planar_rgb_avx2};
+    size_t sizes[] = {1, 15, 16, 17, 96*96, 96*96 + 5};
+
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        std::vector<unsigned char> bgr(3*n);
+        for (size_t i = 0; i < bgr.size(); i++)
+            bgr[i] = std::rand() % 256;
+
+        std::vector<float> expected(3*n);
+        for (size_t i = 0; i < n; ++i) {
+            expected[i    ] = 1./255 * bgr[3*i+2];
+            expected[i+n  ] = 1./255 * bgr[3*i+1];
+            expected[i+2*n] = 1./255 * bgr[3*i  ];
+        }
+
+        for (size_t k = 0; k < 3; k++) {
+            if (!bgr_to_planar_rgb_supported(isas[k]))
+                continue;
+            std::vector<float> out(3*n, -1);
+            kernels[k](bgr.data(), n, out.data(), out.data() + n, out.data() + 2*n);
+            EXPECT_EQ(0, std::memcmp(expected.data(), out.data(), sizeof(float)*3*n))
+                << isas[k] << " kernel differs for " << n << " pixels";
+        }
+    }
+}
+
 /**
  * @test
  * Calling a generic lua function without arguments.